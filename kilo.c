@@ -4,24 +4,57 @@
 
 void editorSetStatusMessage(const char* fmt, ...);
 void editorRefreshScreen();
+void editorInvalidate(int parts);
+void editorProcessKeypress();
 char* editorPrompt(char* prompt, void(*callback)(char*, int));
+int editorAsk(char* question, const char* answers);
+char* editorPromptInput(char* prompt, void(*callback)(char*, int),
+    int allowEmpty);
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 4
 #define KILO_QUIT_TIMES 1
+#define KILO_LONG_LINE (64 * 1024)
+#define KILO_CHUNK_SIZE 4096
+#define KILO_COLD_BLOCK_ROWS 64
+#define KILO_RECENT_EDITS 1024
+#define KILO_MAX_WORKERS 64
+#define KILO_ROWS_PER_WORKER 4096
+#define KILO_DISK_CHECK_MS 1000
+#define KILO_WORD_MAX 64
+#define KILO_COMPLETIONS 32
+#define KILO_INPUT_LATENCY 100
+#define KILO_GREP_MAX_HITS 100000
+#define KILO_STREAM_BATCH (1024 * 1024)
+#define KILO_KILL_RING 8
+#define KILO_FRAME_MS 16
+#define KILO_MESSAGE_MS 5000
+#define KILO_DEADLINES 16
+#define KILO_COUNT_BYTES (4 << 20)
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
@@ -38,59 +71,577 @@ enum editorKey {
   PAGE_DOWN
 };
 
+/*
+  * Parts of the screen a frame may have to draw again
+*/
+enum editorDirty {
+  DIRTY_TEXT = 1,
+  DIRTY_STATUS = 2,
+  DIRTY_MESSAGE = 4,
+  DIRTY_ALL = 7
+};
+
 enum editorHighlight {
   HL_NORMAL = 0,
   HL_COMMENT,
+  HL_MLCOMMENT,
   HL_KEYWORD1,
   HL_KEYWORD2,
   HL_STRING,
   HL_NUMBER,
-  HL_MATCH
+  HL_MATCH,
+  HL_BRACKET,
+  HL_SELECTION
 };
 
 #define HL_HIGHLIGHT_NUMBERS (1 << 0)
 #define HL_HIGHLIGHT_STRINGS (1 << 1)
 
+/*
+  * A small open addressing hash table keyed by
+  * byte strings. The table owns copies of its keys.
+*/
+struct editorHashEntry {
+  char* key;
+  int length;
+  int value;
+  void* data;
+};
+
+struct editorHashTable {
+  struct editorHashEntry* entries;
+  int capacity;
+  int count;
+};
+
 struct editorSyntax {
   char* filetype;
   char** filematch;
   char** keywords;
   char* singleLineCommentStart;
+  char* multiLineCommentStart;
+  char* multiLineCommentEnd;
   int flags;
+  /*
+    * Definition file the entry was read from, NULL
+    * for the built in entries. Only `filetype` and
+    * `filematch` are known until the entry is compiled.
+  */
+  char* path;
+  /*
+    * 0 for the built in entries, else one more than the
+    * directory the definition comes from. A definition
+    * only takes over the names of lower ranked ones.
+  */
+  int rank;
+  int compiled;
+  /*
+    * Lookup tables built by `editorCompileSyntax`
+  */
+  unsigned char separator[256];
+  struct editorHashTable keywordTable;
+};
+
+/*
+  * Where the highlighter is when it stops at the end of
+  * a piece of text, so it can carry on in the next one
+*/
+struct highlightState {
+  int inComment;
+  int inLineComment;
+  int inString;
+  int previousSeparator;
+  unsigned char previousHighlight;
+};
+
+/*
+  * Highlighting is kept as runs of one color over the
+  * rendered text rather than a byte per character. Runs
+  * longer than a span can hold take several spans.
+*/
+#define KILO_SPAN_MAX 0xffff
+
+struct hlSpan {
+  unsigned short length;
+  unsigned char highlight;
+};
+
+/*
+  * What the brackets of a row, outside strings and
+  * comments, do to the nesting depth, openers counting
+  * 1 and closers -1: `sum` in all and `min` the lowest
+  * it goes from the row's start. The highest it goes
+  * counting back from the row's end is `sum - min`.
+*/
+struct bracketSummary {
+  int sum;
+  int min;
+};
+
+/*
+  * Rows longer than `KILO_LONG_LINE` are not rendered as
+  * a whole. They are cut into chunks of about
+  * `KILO_CHUNK_SIZE` bytes of `chars`, and only the chunks
+  * that are on screen get a render and highlight buffer.
+  * Each chunk remembers the column and the highlight
+  * state it starts in, so it can be drawn without looking
+  * at the chunks before it. A scanned chunk also keeps
+  * the summary of its brackets, which add up to the
+  * row's.
+*/
+struct rowChunk {
+  int start;
+  int rx;
+  struct highlightState state;
+  char* render;
+  int rsize;
+  struct hlSpan* spans;
+  int numSpans;
+  struct bracketSummary brackets;
+};
+
+/*
+  * Text of a group of rows that are far from every
+  * window, compressed together. Rows point into the
+  * block until they are needed again.
+*/
+struct coldBlock {
+  char* data;
+  int compressedSize;
+  int size;
+  int refs;
+  /*
+    * Where the compressed text is in the spill file
+    * once `data` was written out and freed
+  */
+  off_t spillOffset;
+};
+
+/*
+  * Text of rows read from a file, stored back to back
+  * with a NUL after each row. Rows borrow their `chars`
+  * from here until they are edited, so scans over the
+  * whole buffer walk memory in order. A block holds the
+  * same rows as a cold block would, so freezing them
+  * lets the text block go.
+*/
+struct textBlock {
+  char* data;
+  int size;
+  int refs;
+};
+
+/*
+  * A group of rows as the file held them when it was
+  * last read or written: where they were and a hash of
+  * their bytes
+*/
+struct diskBlock {
+  uint64_t start;
+  uint64_t end;
+  uint64_t hash;
+  int rows;
 };
 
 typedef struct erow {
+  int idx;
   int size;
   int rsize;
   char* chars;
   char* render;
-  unsigned char* highlight;
+  struct hlSpan* spans;
+  int numSpans;
+  int hlOpenComment;
+  /*
+    * Set when the row holds no byte above 0x7f, so
+    * columns and bytes line up one to one
+  */
+  int ascii;
+  /*
+    * Only used by long rows, which keep `render` and
+    * `spans` NULL. The start column and state of
+    * chunks from `validChunks` on are not known yet.
+  */
+  struct rowChunk* chunks;
+  int numChunks;
+  int validChunks;
+  /*
+    * Cold rows keep only their size and highlight end
+    * state, their text sits at `coldOffset` in `cold`
+  */
+  struct coldBlock* cold;
+  int coldOffset;
+  /*
+    * Set while `chars` points into a shared block
+  */
+  struct textBlock* text;
+  unsigned int lastEdit;
+  /*
+    * The identifiers found in the row when it was last
+    * highlighted, as nodes of the buffer's word index
+  */
+  int* words;
+  int numWords;
+  struct bracketSummary brackets;
+  /*
+    * Columns the row takes on screen, -1 until it is
+    * rendered or measured for wrapping
+  */
+  int columns;
+  /*
+    * Set when the row changed while highlighting was
+    * put off, see `editorDeferHighlight`
+  */
+  int staleHighlight;
+  /*
+    * The words of the row, -1 until they are counted,
+    * and whether it changed since the buffer was last
+    * read or saved. Both go into the buffer's
+    * `bufferStats`.
+  */
+  int wordCount;
+  int changed;
 }erow;
 
-struct editorConfig {
+/*
+  * The identifiers of a buffer in a ternary search tree,
+  * each with the number of times it occurs. Nodes are
+  * kept in one array and never freed, a word that no
+  * longer occurs only has its count drop to 0.
+*/
+struct wordNode {
+  int lo;
+  int eq;
+  int hi;
+  int count;
+  unsigned char c;
+};
+
+/*
+  * Words seen lately, so the common ones skip the walk
+  * down the tree
+*/
+#define KILO_WORD_CACHE 1024
+#define KILO_WORD_CACHED 16
+
+struct wordCacheEntry {
+  char word[KILO_WORD_CACHED];
+  int length;
+  int node;
+};
+
+struct wordIndex {
+  struct wordNode* nodes;
+  int numNodes;
+  int capacity;
+  struct wordCacheEntry* cache;
+};
+
+/*
+  * A segment tree over the bracket summaries of the
+  * rows, with `leaves` a power of two. The first `rows`
+  * leaves hold rows and the rest are 0. Changed rows
+  * update their path to the root. Adding or removing
+  * rows lowers `validRows` to the first row that moved,
+  * and only the leaves from there on and the nodes above
+  * them are worked out again when the tree is next used.
+*/
+struct bracketTree {
+  struct bracketSummary* nodes;
+  int leaves;
+  int rows;
+  int validRows;
+};
+
+/*
+  * Where each row starts when lines are wrapped at
+  * `width` columns: a Fenwick tree over the number of
+  * screen lines of the first `size` rows. A row whose
+  * width changes updates it in place, rows added at the
+  * end are appended, and adding or removing rows
+  * elsewhere cuts `size` back to the first row that
+  * moved, as the nodes up to there only cover rows
+  * above it.
+*/
+struct wrapLayout {
+  int* tree;
+  int size;
+  int capacity;
+  int width;
+  int valid;
+};
+
+/*
+  * Totals over the rows of a buffer, kept up to date as
+  * rows are added, edited and removed, so showing them
+  * never walks the buffer. `bytes` counts the newline
+  * written after each row. Pending rows are left out of
+  * `words` until `editorCountPending` gets to them,
+  * `uncounted` of them are left. The buffer may differ
+  * from its file only while `changedRows` rows are
+  * marked changed or the number of rows is no longer
+  * `savedRows`.
+*/
+struct bufferStats {
+  long long bytes;
+  long long words;
+  int uncounted;
+  int countFrom;
+  int changedRows;
+  int savedRows;
+};
+
+/*
+  * What the bytes held by a buffer are for, so its
+  * memory can be told apart by use. The rows themselves
+  * and the indexes kept per buffer are counted when
+  * asked for, `editorBufferMemory` fills in all of it.
+*/
+enum editorMemory {
+  MEM_TEXT,
+  MEM_RENDER,
+  MEM_HIGHLIGHT,
+  MEM_COLD,
+  MEM_INDEX,
+  MEM_ROWS,
+  MEM_KINDS
+};
+
+/*
+  * A buffer owns the text of one file. Several views
+  * may show the same buffer, so the rows together with
+  * their render and highlight data live here and are
+  * never duplicated per window.
+*/
+struct editorBuffer {
+  int numRows;
+  int rowCapacity;
+  erow *row;
+  /*
+    * Bumped by every edit. Whether the buffer differs
+    * from its file is up to `stats`.
+  */
+  int dirty;
+  char *filename;
+  struct editorSyntax *syntax;
+  /*
+    * Bytes held by the rows of this buffer, by use
+  */
+  size_t memory[MEM_KINDS];
+  /*
+    * The size and text of each row again, in arrays of
+    * their own, so scans over the whole buffer read a
+    * few bytes per row rather than a whole `erow`.
+    * `texts` is NULL for cold rows.
+  */
+  int* sizes;
+  char** texts;
+  /*
+    * Identifiers for completion. Rows taken from a line
+    * index are not highlighted, so their words are only
+    * added, once, when `wordsPending` is set and a
+    * completion asks for them.
+  */
+  struct wordIndex words;
+  int wordsPending;
+  struct bracketTree brackets;
+  struct wrapLayout wrap;
+  struct bufferStats stats;
+  /*
+    * The file as it was when last read or written,
+    * so a change made by another program is noticed
+    * and only the groups of rows it touched are read
+    * again. `diskKnown` is 0 when there is no regular
+    * file to watch.
+  */
+  struct diskBlock* disk;
+  int numDisk;
+  int diskCapacity;
+  int diskKnown;
+  off_t diskSize;
+  struct timespec diskMtime;
+  /*
+    * Rows whose `staleHighlight` is set
+  */
+  int staleRows;
+};
+
+struct editorCursor {
+  int cx;
+  int cy;
+  int anchor;
+};
+
+/*
+  * A view is a window onto a buffer. It keeps its own
+  * cursor and scroll offsets and the part of the screen
+  * it is drawn into.
+*/
+struct editorView {
+  struct editorBuffer *buf;
   int cx;
   int cy;
   int rx;
-  /*
-    * Keep track of what row of the file
-    * the user is currently scrolled to
-  */
   int rowOff;
   int colOff;
+  /*
+    * Set when long rows are wrapped rather than
+    * scrolled sideways. The window then starts at
+    * screen line `lineOff` of row `rowOff`.
+  */
+  int wrap;
+  int lineOff;
+  /*
+    * With several cursors, all of them, sorted by row
+    * and column, `cx` and `cy` following the one at
+    * `primary`. A cursor whose `anchor` is apart from
+    * its `cx` has the bytes between them selected.
+  */
+  struct editorCursor* cursors;
+  int numCursors;
+  int primary;
+  /*
+    * The mark, set with `C-x SPACE`. The region runs
+    * from it to the cursor, and it is the corner of a
+    * column selection. `markCx` is a byte offset and
+    * `markRx` a column.
+  */
+  int markSet;
+  int markRow;
+  int markCx;
+  int markRx;
+  /*
+    * First screen line of the window and the number of
+    * text lines it shows, not counting its status bar
+  */
+  int top;
   int screenRows;
   int screenCols;
-  int numRows;
-  erow *row;
-  int dirty;
-  char *filename;
-  char statusMessage[80];
-  time_t statusMessageTime;
-  struct editorSyntax *syntax;
+  /*
+    * Where the window was and what it showed when the
+    * last frame was drawn, to tell a scroll apart
+  */
+  struct editorBuffer* drawnBuf;
+  int drawnLine;
+  int drawnCol;
+  int drawnTop;
+  int drawnRows;
+};
+
+struct editorConfig {
+  struct editorView **views;
+  int numViews;
+  int currentView;
+  struct editorView *view;
+  struct editorBuffer **buffers;
+  int numBuffers;
+  /*
+    * The whole text area shared by the windows, the
+    * message bar is not included
+  */
+  int screenRows;
+  int screenCols;
+  char statusMessage[256];
+  struct timespec statusMessageTime;
+  /*
+    * Maps file extensions and names to syntax entries,
+    * filled the first time a file is opened from the
+    * index of each of the `syntaxDirs`
+  */
+  struct editorHashTable syntaxMap;
+  int syntaxIndexLoaded;
+  char syntaxDirs[4][PATH_MAX];
+  int numSyntaxDirs;
+  /*
+    * Bytes the buffers may use before cold rows get
+    * compressed, 0 for no limit
+  */
+  size_t memoryBudget;
+  unsigned int editClock;
+  /*
+    * Least time between two frames in milliseconds,
+    * from `--max-fps`, 0 for no cap
+  */
+  int frameInterval;
+  /*
+    * What the next frame has to draw and what is due
+    * later. `dirty` holds the parts of the screen that
+    * changed since the last frame. Each deadline marks
+    * its parts dirty once it has passed, like the message
+    * bar when the status message runs out.
+  */
+  struct {
+    int dirty;
+    struct timespec lastFrame;
+    struct timespec at[KILO_DEADLINES];
+    int parts[KILO_DEADLINES];
+    int count;
+  } render;
+  /*
+    * Keys applied before the last frame was drawn and
+    * the most in any frame, showing how far input ran
+    * ahead of the screen
+  */
+  int inputDepth;
+  int inputPeak;
+  unsigned long frames;
+  /*
+    * What each line of the terminal shows since the last
+    * frame, so a frame only sends the lines that differ.
+    * A NULL line is not known and always drawn.
+  */
+  char** screenLines;
+  int* screenLengths;
+  /*
+    * Terminal features found at start up
+  */
+  int scrollRegions;
+  int syncOutput;
+  /*
+    * The search match on screen, drawn over the
+    * highlight of its row. `chunk` is -1 unless the
+    * row is a long one, `start` is a render offset.
+  */
+  struct {
+    struct editorBuffer* buf;
+    int row;
+    int chunk;
+    int start;
+    int length;
+  } match;
+  /*
+    * The bracket matching the one at the cursor, as a
+    * render offset in a row that is not a long one
+  */
+  struct {
+    struct editorBuffer* buf;
+    int row;
+    int start;
+  } bracket;
+  /*
+    * The words offered for the one being typed, and
+    * the part of the chosen one inserted after `at`
+  */
+  struct {
+    struct editorBuffer* buf;
+    int row;
+    int at;
+    int length;
+    int choice;
+    char* words[KILO_COMPLETIONS];
+    int count;
+  } completion;
   struct termios originalTermios;
 };
 
 struct editorConfig E;
 
+int editorHighlightLongRow(struct editorBuffer* buf, erow* row);
+int editorHighlightColdRow(struct editorBuffer* buf, erow* row);
+int editorScratchRow(struct editorBuffer* buf, erow* row, char** render,
+    unsigned char** highlight, struct highlightState* state);
+void editorScratch(int size, char** render, unsigned char** highlight);
+
 // File type
 
 char *C_HL_extensions[] = { ".c", ".h", ".cpp", NULL };
@@ -101,13 +652,18 @@ char *C_HL_keywords[] = {
   "void|", NULL
 };
 
+/*
+  * Built in definitions, used when no definition file
+  * for the language is installed
+*/
 struct editorSyntax HLDB[] = {
   {
     "c",
     C_HL_extensions,
     C_HL_keywords,
-    "//",
-    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+    "//", "/*", "*/",
+    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+    NULL, 0, 0, {0}, {NULL, 0, 0}
   },
 };
 
@@ -197,26 +753,84 @@ void enableRawMode() {
 }
 
 /*
-  * To deal with the input key
+  * Keys recorded with `C-x (` and played back with
+  * `C-x e`. While playing, `editorReadKey` hands out the
+  * recorded keys instead of reading the terminal, and
+  * the screen and the highlighting wait until the end.
 */
-int editorReadKey() {
-  int nread;
-  char c;
-  while((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+struct keyMacro {
+  int* keys;
+  int length;
+  int capacity;
+  int recording;
+  int replaying;
+  int position;
+  /*
+    * Set when a key was asked for past the end of the
+    * recording, which stops the replay
+  */
+  int exhausted;
+};
+
+static struct keyMacro macro = {NULL, 0, 0, 0, 0, 0, 0};
+
+/*
+  * Input is read from the terminal in bulk and handed
+  * out from here, so a burst of typeahead costs one
+  * `read` rather than one per byte
+*/
+struct inputBuffer {
+  char data[4096];
+  int start;
+  int end;
+};
+
+static struct inputBuffer input = {{0}, 0, 0};
+
+/*
+  * Take one byte of input, waiting at most the `VTIME`
+  * of raw mode for it. Return 0 when none came.
+*/
+int editorReadByte(char* c) {
+  if(input.start == input.end) {
+    int nread = read(STDIN_FILENO, input.data, sizeof(input.data));
     if(nread == -1 && errno != EAGAIN) die("read");
+    if(nread <= 0) return 0;
+    input.start = 0;
+    input.end = nread;
   }
+  *c = input.data[input.start++];
+  return 1;
+}
+
+/*
+  * Whether input is waiting, or arrives within
+  * `timeout` milliseconds
+*/
+int editorInputPending(int timeout) {
+  if(input.start < input.end || macro.replaying) return 1;
+  struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+  return poll(&fd, 1, timeout) > 0;
+}
+
+/*
+  * Decode one key from the terminal
+*/
+int editorDecodeKey() {
+  char c;
+  while(!editorReadByte(&c));
 
   if(c == '\x1b') {
     char seq[3];
 
-    if(read(STDIN_FILENO, &seq[0], 1) != 1)
+    if(!editorReadByte(&seq[0]))
       return '\x1b';
-    if(read(STDIN_FILENO, &seq[1], 1) != 1)
+    if(!editorReadByte(&seq[1]))
       return '\x1b';
 
     if(seq[0] == '[') {
       if(seq[1] >= '0' && seq[1] <= '9') {
-        if(read(STDIN_FILENO, &seq[2], 1) != 1)
+        if(!editorReadByte(&seq[2]))
           return '\x1b';
         if(seq[2] == '~') {
           switch(seq[1]) {
@@ -247,8 +861,32 @@ int editorReadKey() {
     }
     return '\x1b';
   } else {
-    return c;
+    /*
+      * Bytes of UTF-8 sequences are handed out one
+      * by one, they must not turn into negative keys
+    */
+    return (unsigned char)c;
+  }
+}
+
+/*
+  * To deal with the input key
+*/
+int editorReadKey() {
+  if(macro.replaying) {
+    if(macro.position < macro.length) return macro.keys[macro.position++];
+    macro.exhausted = 1;
+    return '\x1b';
+  }
+  int key = editorDecodeKey();
+  if(macro.recording) {
+    if(macro.length == macro.capacity) {
+      macro.capacity = macro.capacity ? macro.capacity * 2 : 64;
+      macro.keys = realloc(macro.keys, sizeof(int) * macro.capacity);
+    }
+    macro.keys[macro.length++] = key;
   }
+  return key;
 }
 
 /*
@@ -320,39 +958,151 @@ int isSeparator(int c) {
   return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
-void editorUpdateSyntax(erow* row) {
-  row->highlight = realloc(row->highlight, row->rsize);
-  memset(row->highlight, HL_NORMAL, row->rsize);
+/*
+  * FNV-1a, good enough for the short keys we keep
+*/
+unsigned int editorHash(const char* s, int length) {
+  unsigned int hash = 2166136261u;
+  for(int i = 0; i < length; ++i) {
+    hash ^= (unsigned char)s[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+struct editorHashEntry* editorHashFind(struct editorHashTable* table,
+    const char* key, int length) {
+  if(table->capacity == 0) return NULL;
+  unsigned int mask = table->capacity - 1;
+  unsigned int i = editorHash(key, length) & mask;
+  while(table->entries[i].key) {
+    struct editorHashEntry* entry = &table->entries[i];
+    if(entry->length == length && !memcmp(entry->key, key, length))
+      return entry;
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+/*
+  * Return the entry for `key`, adding an empty one
+  * when the key is not in the table yet
+*/
+struct editorHashEntry* editorHashInsert(struct editorHashTable* table,
+    const char* key, int length) {
+  struct editorHashEntry* entry = editorHashFind(table, key, length);
+  if(entry) return entry;
+
+  if((table->count + 1) * 2 > table->capacity) {
+    struct editorHashTable grown;
+    grown.capacity = table->capacity ? table->capacity * 2 : 16;
+    grown.count = table->count;
+    grown.entries = calloc(grown.capacity, sizeof(struct editorHashEntry));
+    for(int i = 0; i < table->capacity; ++i) {
+      struct editorHashEntry* old = &table->entries[i];
+      if(old->key == NULL) continue;
+      unsigned int j = editorHash(old->key, old->length) &
+        (grown.capacity - 1);
+      while(grown.entries[j].key) j = (j + 1) & (grown.capacity - 1);
+      grown.entries[j] = *old;
+    }
+    free(table->entries);
+    *table = grown;
+  }
+
+  unsigned int mask = table->capacity - 1;
+  unsigned int i = editorHash(key, length) & mask;
+  while(table->entries[i].key) i = (i + 1) & mask;
+  entry = &table->entries[i];
+  entry->key = malloc(length + 1);
+  memcpy(entry->key, key, length);
+  entry->key[length] = '\0';
+  entry->length = length;
+  entry->value = 0;
+  entry->data = NULL;
+  table->count++;
+  return entry;
+}
+
+void editorHashFree(struct editorHashTable* table) {
+  for(int i = 0; i < table->capacity; ++i)
+    free(table->entries[i].key);
+  free(table->entries);
+  table->entries = NULL;
+  table->capacity = 0;
+  table->count = 0;
+}
+
+/*
+  * Highlight `rsize` bytes of rendered text, starting
+  * in `state` and leaving in it the state the text ends
+  * in. `render` must be NUL terminated.
+*/
+void editorHighlightText(struct editorSyntax* syntax, char* render,
+    int rsize, unsigned char* highlight, struct highlightState* state) {
+  memset(highlight, HL_NORMAL, rsize);
+  if(syntax == NULL) return;
 
-  if(E.syntax == NULL) return;
+  if(state->inLineComment) {
+    memset(highlight, HL_COMMENT, rsize);
+    return;
+  }
 
-  char **keywords = E.syntax->keywords;
+  unsigned char* separator = syntax->separator;
 
-  char *scs = E.syntax->singleLineCommentStart;
+  char *scs = syntax->singleLineCommentStart;
+  char *mcs = syntax->multiLineCommentStart;
+  char *mce = syntax->multiLineCommentEnd;
 
   int scsLength = scs ? strlen(scs) : 0;
+  int mcsLength = mcs ? strlen(mcs) : 0;
+  int mceLength = mce ? strlen(mce) : 0;
 
-  int previousSeparator = 1;
-  int inString = 0;
+  int previousSeparator = state->previousSeparator;
+  int inString = state->inString;
+  int inComment = state->inComment;
 
   int i = 0;
-  while(i < row->rsize) {
-    char c = row->render[i];
+  while(i < rsize) {
+    char c = render[i];
     unsigned char previousHighlight = (i > 0) ?
-      row->highlight[i - 1] : HL_NORMAL;
+      highlight[i - 1] : state->previousHighlight;
 
-    if(scsLength && !inString) {
-      if(!strncmp(&row->render[i], scs, scsLength)) {
-        memset(&row->highlight[i], HL_COMMENT, row->rsize - i);
+    if(scsLength && !inString && !inComment) {
+      if(!strncmp(&render[i], scs, scsLength)) {
+        memset(&highlight[i], HL_COMMENT, rsize - i);
+        state->inLineComment = 1;
         break;
       }
     }
 
-    if(E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+    if(mcsLength && mceLength && !inString) {
+      if(inComment) {
+        highlight[i] = HL_MLCOMMENT;
+        if(!strncmp(&render[i], mce, mceLength)) {
+          int length = mceLength < rsize - i ? mceLength : rsize - i;
+          memset(&highlight[i], HL_MLCOMMENT, length);
+          i += length;
+          inComment = 0;
+          previousSeparator = 1;
+          continue;
+        }
+        i++;
+        continue;
+      } else if(!strncmp(&render[i], mcs, mcsLength)) {
+        int length = mcsLength < rsize - i ? mcsLength : rsize - i;
+        memset(&highlight[i], HL_MLCOMMENT, length);
+        i += length;
+        inComment = 1;
+        continue;
+      }
+    }
+
+    if(syntax->flags & HL_HIGHLIGHT_STRINGS) {
       if(inString) {
-        row->highlight[i] = HL_STRING;
-        if(c == '\\' && i + 1 < row->rsize) {
-          row->highlight[i + 1] = HL_STRING;
+        highlight[i] = HL_STRING;
+        if(c == '\\' && i + 1 < rsize) {
+          highlight[i + 1] = HL_STRING;
           i += 2;
           continue;
         }
@@ -363,565 +1113,6288 @@ void editorUpdateSyntax(erow* row) {
       } else {
         if (c == '"' || c == '\'') {
           inString = c;
-          row->highlight[i] = HL_STRING;
+          highlight[i] = HL_STRING;
           i++;
           continue;
         }
       }
     }
 
-    if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+    if(syntax->flags & HL_HIGHLIGHT_NUMBERS) {
       if((isdigit(c) && (previousSeparator ||
         previousHighlight == HL_NUMBER)) ||
         (c == '.' && previousHighlight == HL_NUMBER)) {
-        row->highlight[i] = HL_NUMBER;
+        highlight[i] = HL_NUMBER;
         i++;
         previousSeparator = 0;
         continue;
       }
     }
 
-    if(previousSeparator) {
-      int j = 0;
-      for(; keywords[j] ; ++j) {
-        int keywordLength = strlen(keywords[j]);
-        int keyword = keywords[j][keywordLength - 1] == '|';
-        if(keyword) keywordLength--;
-
-        if(!strncmp(&row->render[i], keywords[j], keywordLength) &&
-            isSeparator(row->render[i + keywordLength])) {
-          memset(&row->highlight[i], keyword ? HL_KEYWORD2 : HL_KEYWORD1,
-            keywordLength);
-          i += keywordLength;
-          break;
-        }
-      }
-      if(keywords[j] != NULL) {
+    /*
+      * A keyword is a whole token, so find where the
+      * token ends and look it up in one probe
+    */
+    if(previousSeparator && !separator[(unsigned char)c]) {
+      int end = i;
+      while(end < rsize && !separator[(unsigned char)render[end]])
+        end++;
+      struct editorHashEntry* keyword =
+        editorHashFind(&syntax->keywordTable, &render[i], end - i);
+      if(keyword) {
+        memset(&highlight[i], keyword->value, end - i);
+        i = end;
         previousSeparator = 0;
         continue;
       }
     }
 
-    previousSeparator = isSeparator(c);
+    previousSeparator = separator[(unsigned char)c];
     ++i;
   }
+
+  state->previousSeparator = previousSeparator;
+  state->inString = inString;
+  state->inComment = inComment;
+  if(rsize > 0) state->previousHighlight = highlight[rsize - 1];
 }
 
-int editorSyntaxToColor(int highlight) {
-  switch(highlight) {
-    case HL_COMMENT: return 36;
-    case HL_KEYWORD1: return 33;
-    case HL_KEYWORD2: return 32;
-    case HL_STRING: return 35;
-    case HL_NUMBER: return 31;
-    case HL_MATCH: return 34;
-    default: return 37;
+/*
+  * Pack `length` bytes of highlight into spans, reusing
+  * the array in `*spans`. Return the number of spans.
+*/
+int editorEncodeSpans(const unsigned char* highlight, int length,
+    struct hlSpan** spans) {
+  int count = 0;
+  for(int i = 0; i < length; ++count) {
+    int end = i + 1;
+    while(end < length && end - i < KILO_SPAN_MAX &&
+        highlight[end] == highlight[i])
+      end++;
+    i = end;
+  }
+  if(count == 0) {
+    free(*spans);
+    *spans = NULL;
+    return 0;
   }
-}
 
-void editorSelectSyntaxHighlight() {
-  E.syntax = NULL;
-  if(E.filename == NULL) return;
+  *spans = realloc(*spans, sizeof(struct hlSpan) * count);
+  int k = 0;
+  for(int i = 0; i < length; ++k) {
+    int end = i + 1;
+    while(end < length && end - i < KILO_SPAN_MAX &&
+        highlight[end] == highlight[i])
+      end++;
+    (*spans)[k].length = end - i;
+    (*spans)[k].highlight = highlight[i];
+    i = end;
+  }
+  return count;
+}
 
-  char *ext = strrchr(E.filename, '.');
+/*
+  * The state a row starts in. Only multi-line comments
+  * carry over from the row above.
+*/
+void editorRowStartState(struct editorBuffer* buf, erow* row,
+    struct highlightState* state) {
+  state->inComment = (row->idx > 0 && buf->row[row->idx - 1].hlOpenComment);
+  state->inLineComment = 0;
+  state->inString = 0;
+  state->previousSeparator = 1;
+  state->previousHighlight = HL_NORMAL;
+}
 
-  for(unsigned int i = 0; i < HLDB_ENTRIES; ++i) {
-    struct editorSyntax *s = &HLDB[i];
-    unsigned int i = 0;
-    while(s->filematch[i]) {
-      int is_ext = (s->filematch[i][0] == '.');
-      if((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-         (!is_ext && strstr(E.filename, s->filematch[i]))) {
-        E.syntax = s;
-        for(int fileRow = 0; fileRow < E.numRows; fileRow++) {
-          editorUpdateSyntax(&E.row[fileRow]);
-        }
-        return;
+/*
+  * Add one occurrence of a word and return its node
+*/
+int editorWordInsert(struct wordIndex* index, const char* word, int length) {
+  /*
+    * Links are kept as offsets, the nodes may move when
+    * the array grows
+  */
+  size_t link = 0;
+  int node = index->numNodes ? 0 : -1;
+  int i = 0;
+  while(1) {
+    if(node == -1) {
+      if(index->numNodes == index->capacity) {
+        index->capacity = index->capacity ? index->capacity * 2 : 1024;
+        index->nodes = realloc(index->nodes,
+            sizeof(struct wordNode) * index->capacity);
       }
+      node = index->numNodes++;
+      struct wordNode* n = &index->nodes[node];
+      n->lo = n->eq = n->hi = -1;
+      n->count = 0;
+      n->c = word[i];
+      if(node) *(int*)((char*)index->nodes + link) = node;
     }
-    ++i;
+    struct wordNode* n = &index->nodes[node];
+    unsigned char c = word[i];
+    int* next;
+    if(c < n->c) {
+      next = &n->lo;
+    } else if(c > n->c) {
+      next = &n->hi;
+    } else if(i + 1 < length) {
+      next = &n->eq;
+      i++;
+    } else {
+      n->count++;
+      return node;
+    }
+    link = (char*)next - (char*)index->nodes;
+    node = *next;
   }
 }
 
 /*
-  * Change cx to rx
+  * The same, looking in the cache of recent words first
 */
-int editorRowCxToRx(erow *row, int cx) {
-  int rx = 0;
-  for (int i = 0; i < cx; i++) {
-    if (row->chars[i] == '\t')
-      rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
-    rx++;
+int editorWordAdd(struct wordIndex* index, const char* word, int length) {
+  struct wordCacheEntry* entry = NULL;
+  if(length <= KILO_WORD_CACHED) {
+    if(index->cache == NULL)
+      index->cache = calloc(KILO_WORD_CACHE, sizeof(struct wordCacheEntry));
+    entry = &index->cache[editorHash(word, length) % KILO_WORD_CACHE];
+    if(entry->length == length && !memcmp(entry->word, word, length)) {
+      index->nodes[entry->node].count++;
+      return entry->node;
+    }
   }
-  return rx;
-}
-
-int editorRowRxToCx(erow* row, int rx) {
-  int currentRx = 0;
-  int cx;
-  for(cx = 0; cx < row->size; ++cx) {
-    if(row->chars[cx] == '\t')
-      currentRx += (KILO_TAB_STOP - 1) - (currentRx % KILO_TAB_STOP);
-    currentRx++;
+  int node = editorWordInsert(index, word, length);
+  if(entry) {
+    memcpy(entry->word, word, length);
+    entry->length = length;
+    entry->node = node;
   }
-  if(currentRx > rx) return cx;
-  return cx;
-
+  return node;
 }
 
 /*
-  * Copy the original string to render the string
+  * The node where `prefix` ends, or -1
 */
-void editorUpdateRow(erow* row) {
-  int tabs = 0;
-  for(int i = 0; i < row->size; ++i) {
-    if(row->chars[i] == '\t')
-      tabs++;
+int editorWordFind(struct wordIndex* index, const char* prefix, int length) {
+  int node = index->numNodes ? 0 : -1;
+  int i = 0;
+  while(node != -1) {
+    struct wordNode* n = &index->nodes[node];
+    unsigned char c = prefix[i];
+    if(c < n->c) {
+      node = n->lo;
+    } else if(c > n->c) {
+      node = n->hi;
+    } else if(i + 1 < length) {
+      node = n->eq;
+      i++;
+    } else {
+      return node;
+    }
   }
-  free(row->render);
-  row->render = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+  return -1;
+}
 
-  int index = 0;
-  for(int i = 0; i < row->size; ++i) {
-    if(row->chars[i] == '\t') {
-      row->render[index++] = ' ';
-      while(index % KILO_TAB_STOP != 0)
-        row->render[index++] = ' ';
-    } else {
-      row->render[index++] = row->chars[i];
+struct wordMatches {
+  char word[KILO_WORD_MAX + 1];
+  char** words;
+  int count;
+  int max;
+};
+
+/*
+  * Collect, in order, the words below `node` which is
+  * reached after `depth` characters
+*/
+void editorWordCollect(struct wordIndex* index, int node, int depth,
+    struct wordMatches* matches) {
+  while(node != -1 && matches->count < matches->max) {
+    struct wordNode* n = &index->nodes[node];
+    editorWordCollect(index, n->lo, depth, matches);
+    if(matches->count == matches->max) return;
+    matches->word[depth] = n->c;
+    if(n->count > 0) {
+      matches->word[depth + 1] = '\0';
+      matches->words[matches->count++] = strdup(matches->word);
     }
+    editorWordCollect(index, n->eq, depth + 1, matches);
+    node = n->hi;
   }
-  row->render[index] = '\0';
-  row->rsize = index;
+}
+
+/*
+  * Find up to `max` words that start with `prefix`, and
+  * are longer, in alphabetical order. Only the part of
+  * the tree under the prefix is walked.
+*/
+int editorWordComplete(struct wordIndex* index, const char* prefix,
+    int length, char** words, int max) {
+  if(length == 0 || length >= KILO_WORD_MAX) return 0;
+  int node = editorWordFind(index, prefix, length);
+  if(node == -1) return 0;
+  struct wordMatches matches;
+  memcpy(matches.word, prefix, length);
+  matches.words = words;
+  matches.count = 0;
+  matches.max = max;
+  editorWordCollect(index, index->nodes[node].eq, length, &matches);
+  return matches.count;
+}
 
-  editorUpdateSyntax(row);
+int editorIsWordChar(int c) {
+  return isalnum(c) || c == '_' || c >= 0x80;
 }
 
 /*
-  * To handle multiple lines
+  * Replace the words a row had in the index with the
+  * identifiers found by the highlighter, that is the
+  * words outside comments and strings that don't start
+  * with a digit
 */
-void editorInsertRow(int at, char* s, size_t length) {
-  if(at < 0 || at > E.numRows) return;
+void editorIndexWords(struct editorBuffer* buf, erow* row,
+    const char* render, const unsigned char* highlight, int rsize) {
+  static int* found = NULL;
+  static int capacity = 0;
+  int count = 0;
+
+  int i = 0;
+  while(i < rsize) {
+    if(!editorIsWordChar((unsigned char)render[i])) {
+      i++;
+      continue;
+    }
+    int start = i;
+    while(i < rsize && editorIsWordChar((unsigned char)render[i])) i++;
+    int length = i - start;
+    if(length < 2 || length > KILO_WORD_MAX ||
+        isdigit((unsigned char)render[start]) ||
+        highlight[start] == HL_COMMENT || highlight[start] == HL_MLCOMMENT ||
+        highlight[start] == HL_STRING)
+      continue;
+    if(count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      found = realloc(found, sizeof(int) * capacity);
+    }
+    found[count++] = editorWordAdd(&buf->words, &render[start], length);
+  }
+
+  for(int j = 0; j < row->numWords; ++j)
+    buf->words.nodes[row->words[j]].count--;
+  buf->memory[MEM_INDEX] -= sizeof(int) * row->numWords;
+  if(count == 0) {
+    free(row->words);
+    row->words = NULL;
+  } else {
+    if(count != row->numWords)
+      row->words = realloc(row->words, sizeof(int) * count);
+    memcpy(row->words, found, sizeof(int) * count);
+  }
+  row->numWords = count;
+  buf->memory[MEM_INDEX] += sizeof(int) * row->numWords;
+}
+
+void editorFreeWords(struct editorBuffer* buf, erow* row) {
+  for(int j = 0; j < row->numWords; ++j)
+    buf->words.nodes[row->words[j]].count--;
+  buf->memory[MEM_INDEX] -= sizeof(int) * row->numWords;
+  free(row->words);
+  row->words = NULL;
+  row->numWords = 0;
+}
+
+static const signed char bracketValues[256] = {
+  ['('] = 1, ['['] = 1, ['{'] = 1, [')'] = -1, [']'] = -1, ['}'] = -1
+};
 
-  E.row = realloc(E.row, sizeof(erow) * (E.numRows + 1));
-  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numRows - at));
+int editorBracketValue(char c, unsigned char highlight) {
+  int value = bracketValues[(unsigned char)c];
+  if(value && (highlight == HL_COMMENT || highlight == HL_MLCOMMENT ||
+        highlight == HL_STRING))
+    return 0;
+  return value;
+}
 
-  E.row[at].size = length;
-  E.row[at].chars = malloc(length + 1);
-  memcpy(E.row[at].chars, s, length);
-  E.row[at].chars[length] = '\0';
+void editorBracketScan(const char* render, const unsigned char* highlight,
+    int rsize, struct bracketSummary* summary) {
+  int depth = 0;
+  int min = 0;
+  for(int i = 0; i < rsize; ++i) {
+    int value = editorBracketValue(render[i],
+        highlight ? highlight[i] : HL_NORMAL);
+    if(value == 0) continue;
+    depth += value;
+    if(depth < min) min = depth;
+  }
+  summary->sum = depth;
+  summary->min = min;
+}
 
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  E.row[at].highlight = NULL;
-  editorUpdateRow(&E.row[at]);
+void editorBracketCombine(struct bracketSummary* out,
+    const struct bracketSummary* a, const struct bracketSummary* b) {
+  int min = a->sum + b->min;
+  out->min = a->min < min ? a->min : min;
+  out->sum = a->sum + b->sum;
+}
 
-  E.numRows++;
-  E.dirty++;
+/*
+  * Bring the bracket tree up to date from `validRows`
+  * on. It only grows, so rows added and removed around
+  * a power of two don't rebuild it each time.
+*/
+void editorBracketBuild(struct editorBuffer* buf) {
+  struct bracketTree* tree = &buf->brackets;
+  int leaves = tree->leaves ? tree->leaves : 1;
+  while(leaves < buf->numRows) leaves *= 2;
+  int from = tree->validRows;
+  int end = tree->rows > buf->numRows ? tree->rows : buf->numRows;
+  if(leaves != tree->leaves) {
+    tree->leaves = leaves;
+    tree->nodes = realloc(tree->nodes,
+        sizeof(struct bracketSummary) * 2 * leaves);
+    from = 0;
+    end = leaves;
+  }
+  for(int i = from; i < end; ++i) {
+    struct bracketSummary* leaf = &tree->nodes[leaves + i];
+    if(i < buf->numRows) *leaf = buf->row[i].brackets;
+    else leaf->sum = leaf->min = 0;
+  }
+  if(from < end) {
+    int lo = (leaves + from) / 2;
+    int hi = (leaves + end - 1) / 2;
+    for(; lo >= 1; lo /= 2, hi /= 2) {
+      for(int i = lo; i <= hi; ++i)
+        editorBracketCombine(&tree->nodes[i], &tree->nodes[2 * i],
+            &tree->nodes[2 * i + 1]);
+    }
+  }
+  tree->rows = buf->numRows;
+  tree->validRows = buf->numRows;
 }
 
 /*
- * When we delete '\n' we need to free the row
+  * Mark `parts` of the screen as changed when a window
+  * shows `buf`
 */
-void editorFreeRow(erow* row) {
-  free(row->render);
-  free(row->chars);
-  free(row->highlight);
+void editorInvalidateBuffer(struct editorBuffer* buf, int parts) {
+  for(int i = 0; i < E.numViews; ++i) {
+    if(E.views[i]->buf != buf) continue;
+    editorInvalidate(parts);
+    return;
+  }
 }
 
 /*
-  * Insert a single character into an `erow` at
-  * a given position
+  * Rows from `at` on were added, removed or moved. The
+  * bracket tree and the wrap layout keep the rows above
+  * and take in the others the next time they are used.
 */
-void editorRowInsertChar(erow* row, int at, int c) {
-  if(at < 0 || at > row->size) at = row->size;
-  row->chars = realloc(row->chars, row->size + 2);
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  row->size++;
-  row->chars[at] = c;
-  editorUpdateRow(row);
-  E.dirty++;
+void editorRowsMoved(struct editorBuffer* buf, int at) {
+  if(buf->brackets.validRows > at) buf->brackets.validRows = at;
+  if(buf->wrap.size > at) buf->wrap.size = at;
+  editorInvalidateBuffer(buf, DIRTY_TEXT | DIRTY_STATUS);
 }
 
 /*
- * Delete a character in the current row
+  * Store the bracket summary of a row just highlighted
+  * and update the path above it in the tree
 */
-void editorRowDeleteChar(erow* row, int at) {
-  if(at < 0 || at >= row->size) return;
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-  row->size--;
-  editorUpdateRow(row);
-  E.dirty++;
+void editorRowSetBrackets(struct editorBuffer* buf, erow* row,
+    const struct bracketSummary* summary) {
+  if(row->brackets.sum == summary->sum && row->brackets.min == summary->min)
+    return;
+  row->brackets = *summary;
+  struct bracketTree* tree = &buf->brackets;
+  if(row->idx >= tree->validRows) return;
+  int node = tree->leaves + row->idx;
+  tree->nodes[node] = *summary;
+  for(node /= 2; node >= 1; node /= 2)
+    editorBracketCombine(&tree->nodes[node], &tree->nodes[2 * node],
+        &tree->nodes[2 * node + 1]);
 }
 
-void editorInsertChar(int c) {
-  if(E.cy == E.numRows) {
-    editorInsertRow(E.numRows, "", 0);
+/*
+  * The first row from `from` on where the depth, being
+  * `*depth` at the start of `from`, drops below 0.
+  * `*depth` is left at the depth that row starts at.
+*/
+int editorBracketForward(struct bracketTree* tree, int node, int lo, int hi,
+    int from, int* depth) {
+  if(hi <= from) return -1;
+  struct bracketSummary* summary = &tree->nodes[node];
+  if(lo >= from && *depth + summary->min >= 0) {
+    *depth += summary->sum;
+    return -1;
   }
-  editorRowInsertChar(&E.row[E.cy], E.cx, c);
-  E.cx++;
+  if(hi - lo == 1) return lo;
+  int mid = (lo + hi) / 2;
+  int found = editorBracketForward(tree, 2 * node, lo, mid, from, depth);
+  if(found != -1) return found;
+  return editorBracketForward(tree, 2 * node + 1, mid, hi, from, depth);
 }
 
-void editorInsertNewline() {
-  if(E.cx == 0) {
-    editorInsertRow(E.cy, "", 0);
-  } else {
-    erow* row = &E.row[E.cy];
-    editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-    row = &E.row[E.cy];
-    row->size = E.cx;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
+/*
+  * The last row before `to` where the depth counted
+  * back from its end, being `*depth` at the end of the
+  * row, reaches 1
+*/
+int editorBracketBackward(struct bracketTree* tree, int node, int lo, int hi,
+    int to, int* depth) {
+  if(lo >= to) return -1;
+  struct bracketSummary* summary = &tree->nodes[node];
+  if(hi <= to && *depth + summary->sum - summary->min < 1) {
+    *depth += summary->sum;
+    return -1;
   }
-  E.cy++;
-  E.cx = 0;
+  if(hi - lo == 1) return lo;
+  int mid = (lo + hi) / 2;
+  int found = editorBracketBackward(tree, 2 * node + 1, mid, hi, to, depth);
+  if(found != -1) return found;
+  return editorBracketBackward(tree, 2 * node, lo, mid, to, depth);
 }
 
-void editorRowAppendString(erow* row, char* s, size_t length) {
-  row->chars = realloc(row->chars, row->size + length + 1);
-  memcpy(&row->chars[row->size], s, length);
-  row->size += length;
-  row->chars[row->size] = '\0';
-  editorUpdateRow(row);
-  E.dirty++;
+/*
+  * Screen lines a row of `columns` columns takes when
+  * wrapped at `width`
+*/
+int editorWrapLines(int columns, int width) {
+  if(columns <= width) return 1;
+  return (columns + width - 1) / width;
+}
+
+void editorWrapAdd(struct wrapLayout* wrap, int at, int delta) {
+  for(int i = at + 1; i <= wrap->size; i += i & -i)
+    wrap->tree[i] += delta;
 }
 
 /*
- * When the cursor is at the start of the line, we
- * hit the blackspace and delete the row
+  * Screen line row `at` starts at
 */
-void editorDeleteRow(int at) {
-  if(at < 0 || at >= E.numRows) return;
-  editorFreeRow(&E.row[at]);
-  memmove(&E.row[at], &E.row[at + 1], sizeof(erow)
-      * (E.numRows - at - 1));
-  E.numRows--;
-  E.dirty++;
+int editorWrapLine(struct wrapLayout* wrap, int at) {
+  int line = 0;
+  for(int i = at; i > 0; i -= i & -i)
+    line += wrap->tree[i];
+  return line;
 }
 
 /*
- * A wrapper function
+  * The row screen line `line` falls in, with the lines
+  * of that row above it in `*offset`. Lines past the
+  * end fall in row `size`.
 */
-void editorDeleteChar() {
-  if(E.cy == E.numRows) return;
-  if(E.cx == 0 && E.cy == 0) return;
-  erow *row = &E.row[E.cy];
-  if(E.cx > 0) {
-    editorRowDeleteChar(row, E.cx - 1);
-    E.cx--;
-  } else {
-    // go the to the next upper line
-    E.cx = E.row[E.cy - 1].size;
-    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-    editorDeleteRow(E.cy);
-    E.cy--;
+int editorWrapFind(struct wrapLayout* wrap, int line, int* offset) {
+  int step = 1;
+  while(step * 2 <= wrap->size) step *= 2;
+  int at = 0;
+  for(; step > 0; step /= 2) {
+    if(at + step <= wrap->size && wrap->tree[at + step] <= line) {
+      at += step;
+      line -= wrap->tree[at];
+    }
   }
+  *offset = line;
+  return at;
 }
 
-
 /*
-  * Convert the array of `erow` structs into a single
-  * string that is ready to be written out to a file
+  * Store the width of a row just rendered and move the
+  * start of the rows below it when it now wraps into a
+  * different number of lines
 */
-char *editorRowsToString(int* bufLength) {
-  int totalLength = 0;
-  for(int i = 0; i < E.numRows; ++i) {
-    totalLength += E.row[i].size + 1;
-  }
-  *bufLength = totalLength;
-
-  char *buf = malloc(totalLength);
-  char *p = buf;
-  for(int i = 0; i < E.numRows; ++i) {
-    memcpy(p, E.row[i].chars, E.row[i].size);
-    p += E.row[i].size;
-    *p = '\n';
-    p++;
+void editorRowSetColumns(struct editorBuffer* buf, erow* row, int columns) {
+  struct wrapLayout* wrap = &buf->wrap;
+  if(wrap->valid && row->idx < wrap->size && columns >= 0) {
+    int delta = editorWrapLines(columns, wrap->width) -
+      editorWrapLines(row->columns, wrap->width);
+    if(delta) editorWrapAdd(wrap, row->idx, delta);
   }
-  return buf;
+  row->columns = columns;
 }
 
 /*
-  * Open the file and write the content to
-  * `E.row.chars`.
+  * Rows taken from a line index keep their end state
+  * but are not rendered until they are looked at
 */
-void editorOpen(char* filename) {
-  free(E.filename);
-  E.filename = strdup(filename);
+int editorRowIsPending(erow* row) {
+  return row->render == NULL && row->chunks == NULL && row->cold == NULL;
+}
 
-  editorSelectSyntaxHighlight();
+/*
+  * Highlight a single row, starting in the state the
+  * previous row ended in. Return 1 when the state this
+  * row ends in has changed, so the caller knows the
+  * next row has to be highlighted again.
+*/
+int editorHighlightRow(struct editorBuffer* buf, erow* row) {
+  if(row->cold || editorRowIsPending(row))
+    return editorHighlightColdRow(buf, row);
+  if(row->chunks) return editorHighlightLongRow(buf, row);
 
-  FILE *fp = fopen(filename, "r");
-  if(!fp) die("fopen");
+  char* render;
+  unsigned char* highlight;
+  editorScratch(row->rsize + 1, &render, &highlight);
+
+  struct highlightState state;
+  editorRowStartState(buf, row, &state);
+  editorHighlightText(buf->syntax, row->render, row->rsize, highlight,
+      &state);
+  editorIndexWords(buf, row, row->render, highlight, row->rsize);
+  struct bracketSummary brackets;
+  editorBracketScan(row->render, highlight, row->rsize, &brackets);
+  editorRowSetBrackets(buf, row, &brackets);
+
+  buf->memory[MEM_HIGHLIGHT] -= sizeof(struct hlSpan) * row->numSpans;
+  row->numSpans = editorEncodeSpans(highlight, row->rsize, &row->spans);
+  buf->memory[MEM_HIGHLIGHT] += sizeof(struct hlSpan) * row->numSpans;
+
+  int changed = (row->hlOpenComment != state.inComment);
+  row->hlOpenComment = state.inComment;
+  return changed;
+}
 
-  char* line = NULL;
-  size_t lineCap = 0;
-  ssize_t lineLength = -1;
+void editorFreeSpans(struct editorBuffer* buf, erow* row) {
+  buf->memory[MEM_HIGHLIGHT] -= sizeof(struct hlSpan) * row->numSpans;
+  free(row->spans);
+  row->spans = NULL;
+  row->numSpans = 0;
+}
 
-  while((lineLength = getline(&line, &lineCap, fp)) != -1) {
-    while(lineLength > 0 && (line[lineLength - 1]
-      == '\n' || line[lineLength - 1] == '\r'))
-      lineLength--;
-    editorInsertRow(E.numRows, line, lineLength);
+/*
+  * While a macro is replayed, changed rows are only
+  * marked, and all of them highlighted in one pass by
+  * `editorFlushHighlight` once it is done. Return 1
+  * when the row was marked.
+*/
+int editorDeferHighlight(struct editorBuffer* buf, erow* row) {
+  if(!macro.replaying) return 0;
+  if(!row->staleHighlight) {
+    row->staleHighlight = 1;
+    buf->staleRows++;
   }
-  free(line);
-  fclose(fp);
-  E.dirty = 0;
+  return 1;
 }
 
-void editorSave() {
-  if(E.filename == NULL) {
-    E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-    if(E.filename == NULL) {
-      editorSetStatusMessage("Save aborted");
-      return;
+/*
+  * Highlight a row and carry a changed multi-line
+  * comment state on to the rows below it
+*/
+void editorUpdateSyntax(struct editorBuffer* buf, erow* row) {
+  if(editorDeferHighlight(buf, row)) return;
+  while(editorHighlightRow(buf, row) && row->idx + 1 < buf->numRows)
+    row = &buf->row[row->idx + 1];
+}
+
+/*
+  * Highlight the rows in `rows`, in ascending order, in
+  * a single pass. The rows between them are only visited
+  * while the end state of the row above keeps changing,
+  * so no row is highlighted twice.
+*/
+void editorHighlightRows(struct editorBuffer* buf, const int* rows,
+    int count) {
+  if(macro.replaying) {
+    for(int j = 0; j < count; ++j)
+      editorDeferHighlight(buf, &buf->row[rows[j]]);
+    return;
+  }
+  int j = 0;
+  int pending = 0;
+  for(int i = count ? rows[0] : buf->numRows; i < buf->numRows; ++i) {
+    int changed = 0;
+    while(j < count && rows[j] == i) {
+      changed = 1;
+      j++;
+    }
+    if(!changed && !pending) {
+      if(j == count) break;
+      i = rows[j] - 1;
+      continue;
     }
-    editorSelectSyntaxHighlight();
+    pending = editorHighlightRow(buf, &buf->row[i]);
   }
-  int length;
-
-  char *buf = editorRowsToString(&length);
+}
 
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if(fd != -1) {
-    if(ftruncate(fd, length) != -1) {
-      if(write(fd, buf, length) == length) {
-        close(fd);
-        free(buf);
-        E.dirty = 0;
-        editorSetStatusMessage("%d bytes written to disk", length);
-      }
-      return;
-    }
-    close(fd);
+void editorFlushHighlight(struct editorBuffer* buf) {
+  if(buf->staleRows == 0) return;
+  int* rows = malloc(sizeof(int) * buf->staleRows);
+  int count = 0;
+  for(int i = 0; i < buf->numRows && count < buf->staleRows; ++i) {
+    if(!buf->row[i].staleHighlight) continue;
+    buf->row[i].staleHighlight = 0;
+    rows[count++] = i;
   }
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+  editorHighlightRows(buf, rows, count);
+  free(rows);
+  buf->staleRows = 0;
 }
 
-void editorFindCallback(char* query, int key) {
-  static int lastMatch = -1;
-  static int direction = 1;
+int editorSyntaxToColor(int highlight) {
+  switch(highlight) {
+    case HL_COMMENT:
+    case HL_MLCOMMENT: return 36;
+    case HL_KEYWORD1: return 33;
+    case HL_KEYWORD2: return 32;
+    case HL_STRING: return 35;
+    case HL_NUMBER: return 31;
+    case HL_MATCH: return 34;
+    case HL_BRACKET: return 91;
+    case HL_SELECTION: return 7;
+    default: return 37;
+  }
+}
 
-  static int savedHighlightLine;
-  static char* savedHighlight = NULL;
+/*
+  * Append a string to a NULL terminated list
+*/
+char** editorListAppend(char** list, int* count, const char* s) {
+  list = realloc(list, sizeof(char*) * (*count + 2));
+  list[(*count)++] = strdup(s);
+  list[*count] = NULL;
+  return list;
+}
 
-  if(savedHighlight) {
-    memcpy(E.row[savedHighlightLine].highlight,
-          savedHighlight,
-          E.row[savedHighlightLine].rsize);
-    free(savedHighlight);
-    savedHighlight = NULL;
+/*
+  * Directories searched for definition files, the
+  * later ones override the earlier ones
+*/
+int editorSyntaxDirs(char dirs[][PATH_MAX]) {
+  int count = 0;
+  char exe[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if(length > 0) {
+    exe[length] = '\0';
+    char* slash = strrchr(exe, '/');
+    if(slash) *slash = '\0';
+    snprintf(dirs[count++], PATH_MAX, "%.4000s/syntax", exe);
   }
+  snprintf(dirs[count++], PATH_MAX, "/usr/local/share/kilo/syntax");
+  char* home = getenv("HOME");
+  if(home) snprintf(dirs[count++], PATH_MAX, "%s/.kilo/syntax", home);
+  char* env = getenv("KILO_SYNTAX_DIR");
+  if(env) snprintf(dirs[count++], PATH_MAX, "%s", env);
+  return count;
+}
 
-  if(key == '\r' || key == '\x1b') {
-    lastMatch = -1;
-    direction = 1;
-    return;
-  } else if(key == ARROW_RIGHT || key == ARROW_DOWN) {
-    direction = 1;
-  } else if (key == ARROW_LEFT || key == ARROW_UP) {
-    direction = -1;
-  } else {
-    lastMatch = -1;
-    direction = 1;
+void editorRegisterSyntax(struct editorSyntax* s) {
+  for(int i = 0; s->filematch[i]; ++i) {
+    struct editorHashEntry* entry = editorHashInsert(&E.syntaxMap,
+        s->filematch[i], strlen(s->filematch[i]));
+    struct editorSyntax* old = entry->data;
+    if(old == NULL || old->rank <= s->rank) entry->data = s;
   }
-  if(lastMatch == -1) direction = 1;
-  int current = lastMatch;
+}
 
-  for(int i = 0; i < E.numRows; ++i) {
-    current += direction;
-    if(current == -1) current = E.numRows - 1;
-    else if(current == E.numRows) current = 0;
-    erow* row = &E.row[current];
-    char* match = strstr(row->render, query);
-    if(match) {
-      lastMatch = current;
-      E.cy = current;
-      E.cx = editorRowRxToCx(row, match - row->render);
-      E.rowOff = E.numRows;
-
-      savedHighlightLine = current;
-      savedHighlight = malloc(row->rsize);
-      memcpy(savedHighlight, row->highlight, row->rsize);
-      memset(&row->highlight[match - row->render], HL_MATCH,
-        strlen(query));
-      break;
-    }
+/*
+  * Make an entry out of a file type and the names it
+  * matches, which it takes over. Return NULL, freeing
+  * them, when either is missing.
+*/
+struct editorSyntax* editorSyntaxEntry(const char* path, const char* filetype,
+    char** matches, int numMatches) {
+  if(filetype == NULL || matches == NULL) {
+    for(int i = 0; i < numMatches; ++i) free(matches[i]);
+    free(matches);
+    return NULL;
   }
+  struct editorSyntax* s = calloc(1, sizeof(struct editorSyntax));
+  s->filetype = strdup(filetype);
+  s->filematch = matches;
+  s->path = strdup(path);
+  return s;
 }
 
-void editorFind() {
-  int savedCx = E.cx;
-  int savedCy = E.cy;
-  int savedColOff = E.colOff;
-  int savedRowOff = E.rowOff;
+/*
+  * Read only the `filetype` and `filematch` lines of a
+  * definition file, the rest is parsed when a file of
+  * that type is actually opened
+*/
+struct editorSyntax* editorReadSyntaxHeader(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if(!fp) return NULL;
+
+  char* filetype = NULL;
+  char** matches = NULL;
+  int numMatches = 0;
+  char line[1024];
+  while(fgets(line, sizeof(line), fp)) {
+    char* saveptr;
+    char* key = strtok_r(line, " \t\r\n", &saveptr);
+    if(key == NULL || key[0] == '#') continue;
+    if(!strcmp(key, "filetype")) {
+      char* value = strtok_r(NULL, " \t\r\n", &saveptr);
+      if(value && filetype == NULL) filetype = strdup(value);
+    } else if(!strcmp(key, "filematch")) {
+      char* value;
+      while((value = strtok_r(NULL, " \t\r\n", &saveptr)))
+        matches = editorListAppend(matches, &numMatches, value);
+    }
+    if(filetype && matches) break;
+  }
+  fclose(fp);
 
-  char* query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+  struct editorSyntax* s = editorSyntaxEntry(path, filetype, matches,
+      numMatches);
+  free(filetype);
+  return s;
+}
 
-  if(query) {
-    free(query);
-  } else {
-    E.cx = savedCx;
-    E.cy = savedCy;
-    E.colOff = savedColOff;
-    E.rowOff = savedRowOff;
+/*
+  * Register the definitions listed in the `index` file
+  * of a directory, one line each with the file name, the
+  * file type and the names it matches, so none of the
+  * definition files has to be opened
+*/
+void editorReadSyntaxIndex(int dir) {
+  char path[PATH_MAX + 8];
+  if(snprintf(path, sizeof(path), "%s/index", E.syntaxDirs[dir]) >=
+      (int)sizeof(path))
+    return;
+  FILE* fp = fopen(path, "r");
+  if(!fp) return;
+
+  char line[1024];
+  while(fgets(line, sizeof(line), fp)) {
+    char* saveptr;
+    char* file = strtok_r(line, " \t\r\n", &saveptr);
+    if(file == NULL || file[0] == '#') continue;
+    char* filetype = strtok_r(NULL, " \t\r\n", &saveptr);
+    char** matches = NULL;
+    int numMatches = 0;
+    char* value;
+    while(filetype && (value = strtok_r(NULL, " \t\r\n", &saveptr)))
+      matches = editorListAppend(matches, &numMatches, value);
+
+    if(snprintf(path, sizeof(path), "%s/%s", E.syntaxDirs[dir], file) >=
+        (int)sizeof(path))
+      filetype = NULL;
+    struct editorSyntax* s = editorSyntaxEntry(path, filetype, matches,
+        numMatches);
+    if(s == NULL) continue;
+    s->rank = dir + 1;
+    editorRegisterSyntax(s);
   }
+  fclose(fp);
 }
 
-struct appendBuf {
-  char* buf;
-  int length;
-};
-
-#define ABUF_INIT {NULL, 0}
-
 /*
- * Use `realloc` to request much more memory
+  * Build the extension map from the built in entries
+  * and the index of each directory. It costs one short
+  * read per directory however many languages are
+  * installed, and it is done the first time it is
+  * needed rather than at startup.
 */
-void bufferAppend(struct appendBuf* buf, const char* s, int length) {
-  char* new = realloc(buf->buf, buf->length + length);
+void editorLoadSyntaxIndex() {
+  if(E.syntaxIndexLoaded) return;
+  E.syntaxIndexLoaded = 1;
 
-  if(new == NULL) return;
-  memcpy(&new[buf->length], s, length);
-  buf->buf = new;
-  buf->length += length;
+  for(unsigned int i = 0; i < HLDB_ENTRIES; ++i)
+    editorRegisterSyntax(&HLDB[i]);
+
+  E.numSyntaxDirs = editorSyntaxDirs(E.syntaxDirs);
+  for(int i = 0; i < E.numSyntaxDirs; ++i)
+    editorReadSyntaxIndex(i);
 }
 
 /*
- * Free the memory
+  * The entry for an extension or a file name. A
+  * definition file named after it, such as `py.syntax`
+  * for `.py`, needs no index line, and is looked for in
+  * the directories that rank above the entry in the map.
 */
-void bufferFree(struct appendBuf* buf) {
-  free(buf->buf);
+struct editorSyntax* editorFindSyntax(const char* key) {
+  struct editorHashEntry* entry = editorHashFind(&E.syntaxMap, key,
+      strlen(key));
+  struct editorSyntax* s = entry ? entry->data : NULL;
+  const char* name = key[0] == '.' ? key + 1 : key;
+  for(int i = E.numSyntaxDirs - 1; i >= (s ? s->rank : 0); --i) {
+    char path[PATH_MAX + 256];
+    if(snprintf(path, sizeof(path), "%s/%s.syntax", E.syntaxDirs[i], name) >=
+        (int)sizeof(path))
+      continue;
+    struct editorSyntax* found = editorReadSyntaxHeader(path);
+    if(found == NULL) continue;
+    found->rank = i + 1;
+    editorRegisterSyntax(found);
+    return found;
+  }
+  return s;
 }
 
 /*
-  * Check if the cursor has moved outside of the
-  * visible window, and if so, adjust `E.rowOff`
-  * so that the cursor is just inside the visible
-  * window.
+  * Parse the whole definition file of an entry
 */
-void editorScroll() {
-
-  E.rx = 0;
-  if(E.cy < E.numRows) {
-    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+int editorParseSyntax(struct editorSyntax* s) {
+  FILE* fp = fopen(s->path, "r");
+  if(!fp) return -1;
+
+  int numKeywords = 0;
+  char line[4096];
+  while(fgets(line, sizeof(line), fp)) {
+    char* saveptr;
+    char* key = strtok_r(line, " \t\r\n", &saveptr);
+    if(key == NULL || key[0] == '#') continue;
+    char* value = strtok_r(NULL, " \t\r\n", &saveptr);
+    if(value == NULL) continue;
+
+    if(!strcmp(key, "comment")) {
+      free(s->singleLineCommentStart);
+      s->singleLineCommentStart = strdup(value);
+    } else if(!strcmp(key, "multiline-comment")) {
+      char* end = strtok_r(NULL, " \t\r\n", &saveptr);
+      if(end == NULL) continue;
+      free(s->multiLineCommentStart);
+      free(s->multiLineCommentEnd);
+      s->multiLineCommentStart = strdup(value);
+      s->multiLineCommentEnd = strdup(end);
+    } else if(!strcmp(key, "keywords") || !strcmp(key, "types")) {
+      int type = !strcmp(key, "types");
+      do {
+        if(type) {
+          char keyword[256];
+          snprintf(keyword, sizeof(keyword), "%s|", value);
+          s->keywords = editorListAppend(s->keywords, &numKeywords, keyword);
+        } else {
+          s->keywords = editorListAppend(s->keywords, &numKeywords, value);
+        }
+      } while((value = strtok_r(NULL, " \t\r\n", &saveptr)));
+    } else if(!strcmp(key, "flags")) {
+      do {
+        if(!strcmp(value, "numbers")) s->flags |= HL_HIGHLIGHT_NUMBERS;
+        else if(!strcmp(value, "strings")) s->flags |= HL_HIGHLIGHT_STRINGS;
+      } while((value = strtok_r(NULL, " \t\r\n", &saveptr)));
+    }
   }
+  fclose(fp);
 
-  if(E.cy < E.rowOff) {
-    E.rowOff = E.cy;
-  }
-  if(E.cy >= E.rowOff + E.screenRows) {
-    E.rowOff = E.cy - E.screenRows + 1;
-  }
-  if(E.rx < E.colOff) {
-    E.colOff = E.rx;
-  }
-  if(E.rx >= E.colOff + E.screenCols) {
-    E.colOff = E.rx - E.screenCols + 1;
+  if(s->keywords == NULL) {
+    s->keywords = malloc(sizeof(char*));
+    s->keywords[0] = NULL;
   }
+  return 0;
 }
 
 /*
-  * Handle drawing each row of the buffer of text
-  * being edited
+  * Turn an entry into the lookup tables used by the
+  * highlighter. Done once, the first time a file of
+  * that type is opened.
 */
-void editorDrawRows(struct appendBuf* buf) {
-  for(int y = 0; y < E.screenRows; ++y) {
-    int fileRow = y + E.rowOff;
-    if(fileRow >= E.numRows) {
-      if(E.numRows == 0 && y == E.screenRows / 3) {
-        char welcome[80];
-        int welcomeLength = snprintf(welcome, sizeof(welcome),
-            "Kilo editor -- version %s", KILO_VERSION);
-        if(welcomeLength > E.screenCols)
-          welcomeLength = E.screenCols;
-        int padding = (E.screenCols - welcomeLength) / 2;
-        if(padding) {
-          bufferAppend(buf, "~", 1);
-          padding--;
-        }
-        while(padding--)
-          bufferAppend(buf, " ", 1);
-        bufferAppend(buf, welcome, welcomeLength);
+int editorCompileSyntax(struct editorSyntax* s) {
+  if(s->compiled) return 0;
+  if(s->path && editorParseSyntax(s) == -1) return -1;
+
+  for(int c = 0; c < 256; ++c)
+    s->separator[c] = isSeparator(c);
+
+  for(int i = 0; s->keywords[i]; ++i) {
+    int keywordLength = strlen(s->keywords[i]);
+    int keyword = s->keywords[i][keywordLength - 1] == '|';
+    if(keyword) keywordLength--;
+    struct editorHashEntry* entry = editorHashInsert(&s->keywordTable,
+        s->keywords[i], keywordLength);
+    entry->value = keyword ? HL_KEYWORD2 : HL_KEYWORD1;
+  }
+  s->compiled = 1;
+  return 0;
+}
+
+void editorSelectSyntaxHighlight(struct editorBuffer* buf) {
+  buf->syntax = NULL;
+  editorInvalidateBuffer(buf, DIRTY_TEXT | DIRTY_STATUS);
+  if(buf->filename == NULL) return;
+
+  editorLoadSyntaxIndex();
+
+  char *name = strrchr(buf->filename, '/');
+  name = name ? name + 1 : buf->filename;
+  char *ext = strrchr(name, '.');
+
+  struct editorSyntax* s = NULL;
+  if(ext && ext[1]) s = editorFindSyntax(ext);
+  if(s == NULL) s = editorFindSyntax(name);
+  if(s == NULL) return;
+  if(editorCompileSyntax(s) == -1) return;
+
+  buf->syntax = s;
+  for(int fileRow = 0; fileRow < buf->numRows; fileRow++) {
+    editorHighlightRow(buf, &buf->row[fileRow]);
+  }
+}
+
+/*
+  * Code points that take two columns (East Asian wide
+  * and fullwidth forms, emoji) and code points that
+  * take none (combining marks, zero width joiners).
+  * Both tables are sorted so they can be searched
+  * with a binary search.
+*/
+struct widthRange {
+  int first;
+  int last;
+};
+
+static const struct widthRange wideChars[] = {
+  {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+  {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+  {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+  {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+  {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+  {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+  {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+  {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+  {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+  {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+  {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+  {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F004, 0x1F004},
+  {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A},
+  {0x1F200, 0x1F251}, {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF},
+  {0x1F900, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD},
+  {0x30000, 0x3FFFD}
+};
+
+static const struct widthRange zeroWidthChars[] = {
+  {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+  {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+  {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+  {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0900, 0x0902}, {0x093A, 0x093A},
+  {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957},
+  {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF},
+  {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064},
+  {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF},
+  {0x1F3FB, 0x1F3FF}, {0xE0100, 0xE01EF}
+};
+
+#define TABLE_SIZE(table) ((int)(sizeof(table) / sizeof(table[0])))
+
+int editorInRanges(const struct widthRange* table, int size, int cp) {
+  if(cp < table[0].first || cp > table[size - 1].last) return 0;
+  int low = 0;
+  int high = size - 1;
+  while(low <= high) {
+    int mid = (low + high) / 2;
+    if(cp > table[mid].last) low = mid + 1;
+    else if(cp < table[mid].first) high = mid - 1;
+    else return 1;
+  }
+  return 0;
+}
+
+/*
+  * Number of columns a code point takes on screen.
+  * Bytes that are not valid UTF-8 come in as -1 and
+  * are drawn as a single '?'.
+*/
+int editorCharWidth(int cp) {
+  if(cp < 0x300) return 1;
+  if(editorInRanges(zeroWidthChars, TABLE_SIZE(zeroWidthChars), cp))
+    return 0;
+  if(editorInRanges(wideChars, TABLE_SIZE(wideChars), cp))
+    return 2;
+  return 1;
+}
+
+/*
+  * Decode the code point starting at `s` and return the
+  * number of bytes it takes. Malformed sequences take a
+  * single byte and decode to -1.
+*/
+int editorDecodeUTF8(const char* s, int length, int* cp) {
+  const unsigned char* u = (const unsigned char*)s;
+  int need;
+  int value;
+
+  if(u[0] < 0x80) {
+    *cp = u[0];
+    return 1;
+  } else if((u[0] & 0xE0) == 0xC0) {
+    need = 1;
+    value = u[0] & 0x1F;
+  } else if((u[0] & 0xF0) == 0xE0) {
+    need = 2;
+    value = u[0] & 0x0F;
+  } else if((u[0] & 0xF8) == 0xF0) {
+    need = 3;
+    value = u[0] & 0x07;
+  } else {
+    *cp = -1;
+    return 1;
+  }
+
+  if(need >= length) {
+    *cp = -1;
+    return 1;
+  }
+  for(int i = 1; i <= need; ++i) {
+    if((u[i] & 0xC0) != 0x80) {
+      *cp = -1;
+      return 1;
+    }
+    value = (value << 6) | (u[i] & 0x3F);
+  }
+  /*
+    * Reject overlong forms and surrogates
+  */
+  if((need == 1 && value < 0x80) || (need == 2 && value < 0x800) ||
+      (need == 3 && (value < 0x10000 || value > 0x10FFFF)) ||
+      (value >= 0xD800 && value <= 0xDFFF)) {
+    *cp = -1;
+    return 1;
+  }
+  *cp = value;
+  return need + 1;
+}
+
+int editorIsContinuationByte(char c) {
+  return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+/*
+  * Check whether a string is pure ASCII, 16 bytes at a
+  * time with SSE2 or 8 bytes at a time otherwise. Rows
+  * that pass skip UTF-8 decoding altogether.
+*/
+int editorIsAscii(const char* s, int length) {
+  int i = 0;
+#ifdef __SSE2__
+  for(; i + 16 <= length; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(s + i));
+    if(_mm_movemask_epi8(chunk)) return 0;
+  }
+#else
+  for(; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, s + i, sizeof(word));
+    if(word & 0x8080808080808080ULL) return 0;
+  }
+#endif
+  for(; i < length; ++i) {
+    if((unsigned char)s[i] & 0x80) return 0;
+  }
+  return 1;
+}
+
+/*
+  * Column reached after `length` bytes of `chars` when
+  * they start at column `column`
+*/
+int editorTextColumns(const char* chars, int length, int column) {
+  int i = 0;
+  while(i < length) {
+    if(chars[i] == '\t') {
+      column += KILO_TAB_STOP - (column % KILO_TAB_STOP);
+      i++;
+      continue;
+    }
+    int cp;
+    i += editorDecodeUTF8(&chars[i], length - i, &cp);
+    column += editorCharWidth(cp);
+  }
+  return column;
+}
+
+/*
+  * Offset into `chars` of the character covering column
+  * `rx`, when the text starts at column `column`
+*/
+int editorTextOffsetAt(const char* chars, int length, int column, int rx) {
+  int i = 0;
+  while(i < length) {
+    int charLength = 1;
+    if(chars[i] == '\t') {
+      column += KILO_TAB_STOP - (column % KILO_TAB_STOP);
+    } else {
+      int cp;
+      charLength = editorDecodeUTF8(&chars[i], length - i, &cp);
+      column += editorCharWidth(cp);
+    }
+    if(column > rx) return i;
+    i += charLength;
+  }
+  return i;
+}
+
+/*
+  * Bytes of render the first `length` bytes of `chars`
+  * turn into, only tabs change length
+*/
+int editorRenderOffset(const char* chars, int length, int column) {
+  int offset = 0;
+  int i = 0;
+  while(i < length) {
+    if(chars[i] == '\t') {
+      int spaces = KILO_TAB_STOP - (column % KILO_TAB_STOP);
+      offset += spaces;
+      column += spaces;
+      i++;
+      continue;
+    }
+    int cp;
+    int charLength = editorDecodeUTF8(&chars[i], length - i, &cp);
+    offset += charLength;
+    column += editorCharWidth(cp);
+    i += charLength;
+  }
+  return offset;
+}
+
+/*
+  * Expand the tabs of `length` bytes of `chars` into
+  * `out`, starting at column `column`. `out` must hold
+  * length + tabs * (KILO_TAB_STOP - 1) bytes. Return the
+  * number of bytes written and leave the column reached
+  * in `endColumn`.
+*/
+int editorRenderText(const char* chars, int length, int column, int ascii,
+    char* out, int* endColumn) {
+  int index = 0;
+  if(ascii) {
+    for(int i = 0; i < length; ++i) {
+      if(chars[i] == '\t') {
+        do {
+          out[index++] = ' ';
+          column++;
+        } while(column % KILO_TAB_STOP != 0);
       } else {
-        bufferAppend(buf, "~", 1);
+        out[index++] = chars[i];
+        column++;
       }
-    } else {
-      int length = E.row[fileRow].rsize - E.colOff;
-      if(length < 0) length = 0;
-      if (length > E.screenCols)
-        length = E.screenCols;
-      char* c = &E.row[fileRow].render[E.colOff];
-      unsigned char* highlight =
-        &E.row[fileRow].highlight[E.colOff];
-      int currentColor = -1;
-      for(int i = 0; i < length; ++i) {
-        if(iscntrl(c[i])) {
-          char sym = (c[i] <= 26) ? '@' + c[i] : '?';
-          bufferAppend(buf, "\x1b[7m", 4);
-          bufferAppend(buf, &sym, 1);
-          bufferAppend(buf, "\x1b[m", 3);
-          if(currentColor != -1) {
-            char buffer[16];
-            int len = snprintf(buffer, sizeof(buffer), "\x1b[%dm", currentColor);
-            bufferAppend(buf, buffer, len);
-          }
-        } else if(highlight[i] == HL_NORMAL) {
-          if(currentColor != -1) {
-            bufferAppend(buf, "\x1b[39m", 5);
-            currentColor = -1;
-          }
-          bufferAppend(buf, &c[i], 1);
+    }
+  } else {
+    int i = 0;
+    while(i < length) {
+      if(chars[i] == '\t') {
+        do {
+          out[index++] = ' ';
+          column++;
+        } while(column % KILO_TAB_STOP != 0);
+        i++;
+        continue;
+      }
+      int cp;
+      int charLength = editorDecodeUTF8(&chars[i], length - i, &cp);
+      memcpy(&out[index], &chars[i], charLength);
+      index += charLength;
+      column += editorCharWidth(cp);
+      i += charLength;
+    }
+  }
+  *endColumn = column;
+  return index;
+}
+
+int editorCountTabs(const char* chars, int length) {
+  int tabs = 0;
+  for(int i = 0; i < length; ++i) {
+    if(chars[i] == '\t')
+      tabs++;
+  }
+  return tabs;
+}
+
+int editorChunkEnd(erow* row, int k) {
+  return k + 1 < row->numChunks ? row->chunks[k + 1].start : row->size;
+}
+
+/*
+  * Index of the chunk holding byte `at` of a long row
+*/
+int editorChunkAt(erow* row, int at) {
+  int low = 0;
+  int high = row->numChunks - 1;
+  while(low < high) {
+    int mid = (low + high + 1) / 2;
+    if(row->chunks[mid].start <= at) low = mid;
+    else high = mid - 1;
+  }
+  return low;
+}
+
+void editorChunkRelease(struct editorBuffer* buf, struct rowChunk* chunk) {
+  if(chunk->render == NULL) return;
+  buf->memory[MEM_RENDER] -= chunk->rsize + 1;
+  buf->memory[MEM_HIGHLIGHT] -= sizeof(struct hlSpan) * chunk->numSpans;
+  free(chunk->render);
+  free(chunk->spans);
+  chunk->render = NULL;
+  chunk->spans = NULL;
+  chunk->numSpans = 0;
+  chunk->rsize = 0;
+}
+
+/*
+  * Buffers for chunks that are scanned but not kept
+*/
+void editorScratch(int size, char** render, unsigned char** highlight) {
+  static char* scratchRender = NULL;
+  static unsigned char* scratchHighlight = NULL;
+  static int scratchSize = 0;
+  if(size > scratchSize) {
+    scratchRender = realloc(scratchRender, size);
+    scratchHighlight = realloc(scratchHighlight, size);
+    scratchSize = size;
+  }
+  *render = scratchRender;
+  *highlight = scratchHighlight;
+}
+
+int editorStateEqual(struct highlightState* a, struct highlightState* b) {
+  return a->inComment == b->inComment &&
+    a->inLineComment == b->inLineComment &&
+    a->inString == b->inString &&
+    a->previousSeparator == b->previousSeparator &&
+    a->previousHighlight == b->previousHighlight;
+}
+
+/*
+  * Render and highlight chunk `k`, whose start must be
+  * known. With `keep` set the result stays in the chunk,
+  * otherwise it goes to a scratch buffer. Either way the
+  * start of the next chunk becomes known.
+*/
+void editorChunkScan(struct editorBuffer* buf, erow* row, int k, int keep,
+    int* endColumn, struct highlightState* endState) {
+  struct rowChunk* chunk = &row->chunks[k];
+  int start = chunk->start;
+  int length = editorChunkEnd(row, k) - start;
+  int capacity = length + editorCountTabs(&row->chars[start], length) *
+    (KILO_TAB_STOP - 1) + 1;
+
+  char* render;
+  unsigned char* highlight;
+  editorScratch(capacity, &render, &highlight);
+  if(keep) {
+    editorChunkRelease(buf, chunk);
+    render = malloc(capacity);
+  }
+
+  int rsize = editorRenderText(&row->chars[start], length, chunk->rx, 0,
+      render, endColumn);
+  render[rsize] = '\0';
+  *endState = chunk->state;
+  editorHighlightText(buf->syntax, render, rsize, highlight, endState);
+  editorBracketScan(render, highlight, rsize, &chunk->brackets);
+
+  if(keep) {
+    chunk->render = render;
+    chunk->rsize = rsize;
+    chunk->numSpans = editorEncodeSpans(highlight, rsize, &chunk->spans);
+    buf->memory[MEM_RENDER] += rsize + 1;
+    buf->memory[MEM_HIGHLIGHT] += sizeof(struct hlSpan) * chunk->numSpans;
+  }
+
+  if(k + 1 < row->numChunks && k + 1 >= row->validChunks) {
+    row->chunks[k + 1].rx = *endColumn;
+    row->chunks[k + 1].state = *endState;
+    row->validChunks = k + 2;
+  }
+}
+
+/*
+  * Make the start of the chunks up to `k` known
+*/
+void editorChunkValidate(struct editorBuffer* buf, erow* row, int k) {
+  while(row->validChunks <= k) {
+    int column;
+    struct highlightState state;
+    editorChunkScan(buf, row, row->validChunks - 1, 0, &column, &state);
+  }
+}
+
+/*
+  * Return chunk `k` with its render and highlight ready
+*/
+struct rowChunk* editorRowChunk(struct editorBuffer* buf, erow* row, int k) {
+  editorChunkValidate(buf, row, k);
+  if(row->chunks[k].render == NULL) {
+    int column;
+    struct highlightState state;
+    editorChunkScan(buf, row, k, 1, &column, &state);
+  }
+  return &row->chunks[k];
+}
+
+/*
+  * Index of the chunk covering column `rx`. The row is
+  * only scanned as far as the column itself.
+*/
+int editorChunkAtColumn(struct editorBuffer* buf, erow* row, int rx) {
+  while(row->validChunks < row->numChunks &&
+      row->chunks[row->validChunks - 1].rx <= rx) {
+    int column;
+    struct highlightState state;
+    editorChunkScan(buf, row, row->validChunks - 1, 0, &column, &state);
+  }
+  int low = 0;
+  int high = row->validChunks - 1;
+  while(low < high) {
+    int mid = (low + high + 1) / 2;
+    if(row->chunks[mid].rx <= rx) low = mid;
+    else high = mid - 1;
+  }
+  return low;
+}
+
+/*
+  * Drop the render of chunks outside `first..last`,
+  * keeping one chunk on either side for short scrolls
+*/
+void editorTrimChunks(struct editorBuffer* buf, erow* row, int first,
+    int last) {
+  for(int k = 0; k < row->numChunks; ++k) {
+    if(k < first - 1 || k > last + 1)
+      editorChunkRelease(buf, &row->chunks[k]);
+  }
+}
+
+void editorFreeChunks(struct editorBuffer* buf, erow* row) {
+  for(int k = 0; k < row->numChunks; ++k)
+    editorChunkRelease(buf, &row->chunks[k]);
+  free(row->chunks);
+  row->chunks = NULL;
+  row->numChunks = 0;
+  row->validChunks = 0;
+}
+
+/*
+  * Scan the rest of a long row for the multi-line
+  * comment state it ends in
+*/
+int editorLongRowEndState(struct editorBuffer* buf, erow* row) {
+  int last = row->numChunks - 1;
+  editorChunkValidate(buf, row, last);
+  int column;
+  struct highlightState state;
+  editorChunkScan(buf, row, last, 0, &column, &state);
+  return state.inComment;
+}
+
+/*
+  * Add up the brackets of the chunks of a long row, all
+  * of which have been scanned
+*/
+void editorLongRowBrackets(struct editorBuffer* buf, erow* row) {
+  struct bracketSummary brackets = row->chunks[0].brackets;
+  for(int k = 1; k < row->numChunks; ++k)
+    editorBracketCombine(&brackets, &brackets, &row->chunks[k].brackets);
+  editorRowSetBrackets(buf, row, &brackets);
+}
+
+int editorHighlightLongRow(struct editorBuffer* buf, erow* row) {
+  for(int k = 0; k < row->numChunks; ++k)
+    editorChunkRelease(buf, &row->chunks[k]);
+  row->chunks[0].rx = 0;
+  editorRowStartState(buf, row, &row->chunks[0].state);
+  row->validChunks = 1;
+
+  int inComment = editorLongRowEndState(buf, row);
+  editorLongRowBrackets(buf, row);
+
+  int changed = (row->hlOpenComment != inComment);
+  row->hlOpenComment = inComment;
+  return changed;
+}
+
+/*
+  * Where a chunk meant to start at byte `start` of a row
+  * does start: just after white space close by, so no
+  * comment delimiter, escape or keyword is cut in two,
+  * else at least never inside a UTF-8 sequence
+*/
+int editorChunkBoundary(erow* row, int start) {
+  for(int i = start; i < row->size && i < start + KILO_CHUNK_SIZE / 4; ++i)
+    if(row->chars[i - 1] == ' ' || row->chars[i - 1] == '\t') return i;
+  while(start < row->size && editorIsContinuationByte(row->chars[start]))
+    start++;
+  return start;
+}
+
+/*
+  * Cut a row into chunks, dropping its render
+*/
+void editorBuildChunks(struct editorBuffer* buf, erow* row) {
+  free(row->render);
+  row->render = NULL;
+  editorFreeSpans(buf, row);
+  row->rsize = 0;
+  row->ascii = 0;
+  if(row->chunks) editorFreeChunks(buf, row);
+
+  row->numChunks = (row->size + KILO_CHUNK_SIZE - 1) / KILO_CHUNK_SIZE;
+  row->chunks = malloc(sizeof(struct rowChunk) * row->numChunks);
+  for(int k = 0; k < row->numChunks; ++k) {
+    int start = k > 0 ? editorChunkBoundary(row, k * KILO_CHUNK_SIZE) : 0;
+    row->chunks[k].start = start;
+    row->chunks[k].render = NULL;
+    row->chunks[k].spans = NULL;
+    row->chunks[k].numSpans = 0;
+    row->chunks[k].rsize = 0;
+    row->chunks[k].brackets.sum = row->chunks[k].brackets.min = 0;
+  }
+  row->chunks[0].rx = 0;
+  editorRowStartState(buf, row, &row->chunks[0].state);
+  row->validChunks = 1;
+}
+
+/*
+  * Copy the size and text of a row to the scan arrays
+*/
+void editorSyncRow(struct editorBuffer* buf, erow* row) {
+  buf->sizes[row->idx] = row->size;
+  buf->texts[row->idx] = row->cold ? NULL : row->chars;
+}
+
+/*
+  * Make room for `count` more rows in the row arrays.
+  * They grow by half again at least, so rows added a
+  * group at a time, as from a pipe, are not copied over
+  * and over.
+*/
+void editorGrowRows(struct editorBuffer* buf, int count) {
+  int rows = buf->numRows + count;
+  if(rows <= buf->rowCapacity) return;
+  if(rows < buf->rowCapacity + buf->rowCapacity / 2)
+    rows = buf->rowCapacity + buf->rowCapacity / 2;
+  buf->rowCapacity = rows;
+  buf->row = realloc(buf->row, sizeof(erow) * rows);
+  buf->sizes = realloc(buf->sizes, sizeof(int) * rows);
+  buf->texts = realloc(buf->texts, sizeof(char*) * rows);
+}
+
+/*
+  * Bring a long row up to date after `delta` bytes were
+  * inserted at `at`, or removed from there when `delta`
+  * is negative. Only the chunk holding the edit is
+  * scanned again. The chunks after it keep their cached
+  * start as long as the highlight state and the tab
+  * alignment at the chunk boundary stay the same.
+*/
+void editorUpdateLongRow(struct editorBuffer* buf, erow* row, int at,
+    int delta) {
+  int k = editorChunkAt(row, at);
+  int m = delta < 0 ? editorChunkAt(row, at - delta) : k;
+
+  /*
+    * Chunks swallowed by a deletion merge into chunk k
+  */
+  if(m > k) {
+    for(int j = k + 1; j <= m; ++j)
+      editorChunkRelease(buf, &row->chunks[j]);
+    memmove(&row->chunks[k + 1], &row->chunks[m + 1],
+        sizeof(struct rowChunk) * (row->numChunks - m - 1));
+    row->numChunks -= m - k;
+    if(row->validChunks > m + 1) row->validChunks -= m - k;
+    else if(row->validChunks > k + 1) row->validChunks = k + 1;
+  }
+  for(int j = k + 1; j < row->numChunks; ++j)
+    row->chunks[j].start += delta;
+  editorChunkRelease(buf, &row->chunks[k]);
+
+  int last = k;
+  int validEnd = row->validChunks;
+  if(editorChunkEnd(row, k) - row->chunks[k].start > 2 * KILO_CHUNK_SIZE) {
+    int start = editorChunkBoundary(row,
+        row->chunks[k].start + KILO_CHUNK_SIZE);
+    row->chunks = realloc(row->chunks,
+        sizeof(struct rowChunk) * (row->numChunks + 1));
+    memmove(&row->chunks[k + 2], &row->chunks[k + 1],
+        sizeof(struct rowChunk) * (row->numChunks - k - 1));
+    row->numChunks++;
+    row->chunks[k + 1].start = start;
+    row->chunks[k + 1].render = NULL;
+    row->chunks[k + 1].spans = NULL;
+    row->chunks[k + 1].numSpans = 0;
+    row->chunks[k + 1].rsize = 0;
+    row->chunks[k + 1].brackets.sum = row->chunks[k + 1].brackets.min = 0;
+    if(validEnd > k + 1) validEnd++;
+    last = k + 1;
+  }
+
+  if(k < row->validChunks) {
+    int nextKnown = last + 1 < row->numChunks && last + 1 < validEnd;
+    struct rowChunk old;
+    if(nextKnown) old = row->chunks[last + 1];
+
+    row->validChunks = k + 1;
+    int column;
+    struct highlightState state;
+    for(int j = k; j <= last; ++j)
+      editorChunkScan(buf, row, j, 0, &column, &state);
+
+    if(nextKnown) {
+      int shift = column - old.rx;
+      if(editorStateEqual(&state, &old.state) && shift % KILO_TAB_STOP == 0) {
+        for(int j = last + 2; j < validEnd; ++j)
+          row->chunks[j].rx += shift;
+        row->validChunks = validEnd;
+        editorLongRowBrackets(buf, row);
+        return;
+      }
+    } else if(last + 1 == row->numChunks) {
+      if(state.inComment == row->hlOpenComment) {
+        editorLongRowBrackets(buf, row);
+        return;
+      }
+    }
+  }
+
+  /*
+    * The boundary moved, so whatever follows has to be
+    * looked at again
+  */
+  for(int j = last + 1; j < row->numChunks; ++j)
+    editorChunkRelease(buf, &row->chunks[j]);
+  int inComment = editorLongRowEndState(buf, row);
+  editorLongRowBrackets(buf, row);
+  if(inComment != row->hlOpenComment) {
+    row->hlOpenComment = inComment;
+    if(row->idx + 1 < buf->numRows)
+      editorUpdateSyntax(buf, &buf->row[row->idx + 1]);
+  }
+}
+
+/*
+  * Change cx to rx
+*/
+int editorRowCxToRx(struct editorBuffer* buf, erow *row, int cx) {
+  int rx = 0;
+  if(row->chunks) {
+    int k = editorChunkAt(row, cx);
+    editorChunkValidate(buf, row, k);
+    struct rowChunk* chunk = &row->chunks[k];
+    return editorTextColumns(&row->chars[chunk->start], cx - chunk->start,
+        chunk->rx);
+  }
+  if(row->ascii) {
+    for (int i = 0; i < cx; i++) {
+      if (row->chars[i] == '\t')
+        rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
+      rx++;
+    }
+    return rx;
+  }
+  return editorTextColumns(row->chars, cx, 0);
+}
+
+int editorRowRxToCx(struct editorBuffer* buf, erow* row, int rx) {
+  int currentRx = 0;
+  int cx;
+  if(row->chunks) {
+    int k = editorChunkAtColumn(buf, row, rx);
+    struct rowChunk* chunk = &row->chunks[k];
+    return chunk->start + editorTextOffsetAt(&row->chars[chunk->start],
+        editorChunkEnd(row, k) - chunk->start, chunk->rx, rx);
+  }
+  if(row->ascii) {
+    for(cx = 0; cx < row->size; ++cx) {
+      if(row->chars[cx] == '\t')
+        currentRx += (KILO_TAB_STOP - 1) - (currentRx % KILO_TAB_STOP);
+      currentRx++;
+      if(currentRx > rx) return cx;
+    }
+    return cx;
+  }
+  return editorTextOffsetAt(row->chars, row->size, 0, rx);
+}
+
+/*
+  * Map a byte offset into `render` back to `chars`.
+  * Only tabs change length when rendered, so this does
+  * not need to decode anything.
+*/
+int editorRowRenderToCx(struct editorBuffer* buf, erow* row,
+    int renderIndex) {
+  if(row->ascii) return editorRowRxToCx(buf, row, renderIndex);
+  int index = 0;
+  int rx = 0;
+  int cx;
+  for(cx = 0; cx < row->size; ++cx) {
+    int length = 1;
+    if(row->chars[cx] == '\t') {
+      length = KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+      rx += length;
+    } else if(!editorIsContinuationByte(row->chars[cx])) {
+      int cp;
+      editorDecodeUTF8(&row->chars[cx], row->size - cx, &cp);
+      rx += editorCharWidth(cp);
+    }
+    if(index + length > renderIndex) return cx;
+    index += length;
+  }
+  return cx;
+}
+
+/*
+  * Add the bytes a row holds on the heap to the memory
+  * accounting of its buffer, or with `sign` -1 take
+  * them out before they change. The render of chunks
+  * and the highlight spans are accounted for where they
+  * are made, since rows below an edit may have theirs
+  * redone too.
+*/
+void editorRowAccount(struct editorBuffer* buf, erow* row, int sign) {
+  size_t text = 0;
+  if(row->chars && row->text == NULL) text = row->size + 1;
+  size_t render = sizeof(struct rowChunk) * row->numChunks;
+  if(row->render) render += row->rsize + 1;
+  if(sign > 0) {
+    buf->memory[MEM_TEXT] += text;
+    buf->memory[MEM_RENDER] += render;
+  } else {
+    buf->memory[MEM_TEXT] -= text;
+    buf->memory[MEM_RENDER] -= render;
+  }
+}
+
+int editorIsBlank(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/*
+  * Words in `length` bytes of text, counted the way
+  * `wc -w` does: runs of bytes other than white space
+*/
+int editorCountWords(const char* s, int length) {
+  int words = 0;
+  int space = 1;
+  for(int i = 0; i < length; ++i) {
+    int blank = editorIsBlank(s[i]);
+    words += space && !blank;
+    space = blank;
+  }
+  return words;
+}
+
+/*
+  * Words of `s` in `at..end-1`, the words cut at either
+  * end taken in whole. The other words of `s` don't
+  * change when those bytes are replaced, so the words
+  * of a row change by the difference between this
+  * before and after an edit.
+*/
+int editorWordsAround(const char* s, int size, int at, int end) {
+  while(at > 0 && !editorIsBlank(s[at - 1])) at--;
+  while(end < size && !editorIsBlank(s[end])) end++;
+  return editorCountWords(&s[at], end - at);
+}
+
+/*
+  * Add a row to the totals of its buffer, or take it
+  * out of them with `sign` -1. The words of a row being
+  * added are counted unless it is pending.
+*/
+void editorRowCount(struct editorBuffer* buf, erow* row, int sign) {
+  if(sign > 0) {
+    row->wordCount = editorRowIsPending(row) ? -1 :
+      editorCountWords(row->chars, row->size);
+  }
+  buf->stats.bytes += sign * (row->size + 1);
+  if(row->wordCount < 0) buf->stats.uncounted += sign;
+  else buf->stats.words += sign * row->wordCount;
+  buf->stats.changedRows += sign * row->changed;
+}
+
+/*
+  * Mark a row as changed since the last save
+*/
+void editorRowTouch(struct editorBuffer* buf, erow* row) {
+  if(row->changed) return;
+  row->changed = 1;
+  buf->stats.changedRows++;
+}
+
+/*
+  * Take the words around bytes `at..end-1` of a row out
+  * of the totals, before those bytes are replaced
+*/
+void editorRowUncount(struct editorBuffer* buf, erow* row, int at, int end) {
+  if(row->wordCount < 0) return;
+  int words = editorWordsAround(row->chars, row->size, at, end);
+  row->wordCount -= words;
+  buf->stats.words -= words;
+}
+
+/*
+  * Bring the totals up to date after bytes `at..end-1`
+  * of a row were put in place of those passed to
+  * `editorRowUncount`. Rows whose words were never
+  * counted are counted whole. Called before
+  * `editorSyncRow`, while the scan arrays still hold its
+  * old size.
+*/
+void editorRowEditedAround(struct editorBuffer* buf, erow* row, int at,
+    int end) {
+  buf->stats.bytes += row->size - buf->sizes[row->idx];
+  if(row->wordCount < 0) {
+    buf->stats.uncounted--;
+    row->wordCount = 0;
+    at = 0;
+    end = row->size;
+  }
+  int words = editorWordsAround(row->chars, row->size, at, end);
+  row->wordCount += words;
+  buf->stats.words += words;
+  row->lastEdit = ++E.editClock;
+  editorRowTouch(buf, row);
+  editorInvalidateBuffer(buf, DIRTY_TEXT | DIRTY_STATUS);
+}
+
+/*
+  * Bring the totals up to date after all the text of a
+  * row was replaced
+*/
+void editorRowEdited(struct editorBuffer* buf, erow* row) {
+  if(row->wordCount > 0) {
+    buf->stats.words -= row->wordCount;
+    row->wordCount = 0;
+  }
+  editorRowEditedAround(buf, row, 0, row->size);
+}
+
+/*
+  * Whether a buffer may differ from its file as last
+  * read or saved
+*/
+int editorBufferModified(struct editorBuffer* buf) {
+  return buf->stats.changedRows || buf->numRows != buf->stats.savedRows;
+}
+
+/*
+  * Take the rows of a buffer as being the same as its
+  * file, after it was read or saved
+*/
+void editorMarkSaved(struct editorBuffer* buf) {
+  for(int i = 0; i < buf->numRows && buf->stats.changedRows; ++i) {
+    if(!buf->row[i].changed) continue;
+    buf->row[i].changed = 0;
+    buf->stats.changedRows--;
+  }
+  buf->stats.savedRows = buf->numRows;
+  editorInvalidateBuffer(buf, DIRTY_STATUS);
+}
+
+/*
+  * Long rows are only measured while their buffer has
+  * a wrap layout. Once the column of their last chunk is
+  * known, as it is after an edit, only that chunk is
+  * measured, else all of their text is.
+*/
+void editorMeasureLongRow(struct editorBuffer* buf, erow* row) {
+  if(buf->wrap.width == 0) {
+    row->columns = -1;
+    return;
+  }
+  int k = row->validChunks == row->numChunks ? row->numChunks - 1 : 0;
+  int start = row->chunks[k].start;
+  editorRowSetColumns(buf, row, editorTextColumns(&row->chars[start],
+        row->size - start, row->chunks[k].rx));
+}
+
+/*
+  * Copy the original string to render the string,
+  * leaving the highlight alone. Tabs stop at display
+  * columns, which only differ from byte offsets in rows
+  * that are not pure ASCII. Long rows are only cut into
+  * chunks here.
+*/
+void editorRenderRow(struct editorBuffer* buf, erow* row) {
+  if(row->size > KILO_LONG_LINE ||
+      (row->chunks && row->size > KILO_LONG_LINE / 2)) {
+    editorBuildChunks(buf, row);
+    editorMeasureLongRow(buf, row);
+    return;
+  }
+  if(row->chunks) editorFreeChunks(buf, row);
+
+  int tabs = editorCountTabs(row->chars, row->size);
+  free(row->render);
+  row->render = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+  row->ascii = editorIsAscii(row->chars, row->size);
+
+  int column;
+  row->rsize = editorRenderText(row->chars, row->size, 0, row->ascii,
+      row->render, &column);
+  row->render[row->rsize] = '\0';
+  editorRowSetColumns(buf, row, column);
+}
+
+void editorUpdateRow(struct editorBuffer* buf, erow* row) {
+  editorRenderRow(buf, row);
+  editorUpdateSyntax(buf, row);
+}
+
+/*
+  * Called after `delta` bytes of `chars` changed at
+  * `at`, so long rows only redo the chunks involved.
+  * The words around the bytes replaced were taken out
+  * with `editorRowUncount` before.
+*/
+void editorRowChanged(struct editorBuffer* buf, erow* row, int at,
+    int delta) {
+  editorRowEditedAround(buf, row, at, at + (delta > 0 ? delta : 0));
+  editorSyncRow(buf, row);
+  if(row->chunks && row->size > KILO_LONG_LINE / 2) {
+    editorUpdateLongRow(buf, row, at, delta);
+    editorMeasureLongRow(buf, row);
+  } else {
+    editorUpdateRow(buf, row);
+  }
+}
+
+/*
+  * A small LZ77 codec in the spirit of LZ4. Each sequence
+  * is a token byte holding the number of literals in its
+  * high nibble and the match length minus 4 in its low
+  * nibble, a nibble of 15 being continued by extra bytes.
+  * The literals follow, then a two byte offset and the
+  * extra match length bytes. The last sequence has no
+  * match.
+*/
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+
+int editorCompressBound(int size) {
+  return size + size / 255 + 16;
+}
+
+void editorLzPutLength(unsigned char* out, int* o, int length) {
+  while(length >= 255) {
+    out[(*o)++] = 255;
+    length -= 255;
+  }
+  out[(*o)++] = length;
+}
+
+int editorLzGetLength(const unsigned char* in, int* i, int size) {
+  int length = 0;
+  while(*i < size) {
+    int byte = in[(*i)++];
+    length += byte;
+    if(byte != 255) break;
+  }
+  return length;
+}
+
+/*
+  * Emit one sequence and return the new output position
+*/
+int editorLzSequence(unsigned char* out, int o, const char* literals,
+    int literalLength, int offset, int matchLength) {
+  int token = o++;
+  int literalNibble = literalLength < 15 ? literalLength : 15;
+  int matchNibble = 0;
+  if(matchLength) {
+    matchNibble = matchLength - LZ_MIN_MATCH;
+    if(matchNibble > 15) matchNibble = 15;
+  }
+  out[token] = (literalNibble << 4) | matchNibble;
+  if(literalLength >= 15) editorLzPutLength(out, &o, literalLength - 15);
+  memcpy(&out[o], literals, literalLength);
+  o += literalLength;
+  if(matchLength) {
+    out[o++] = offset & 0xff;
+    out[o++] = offset >> 8;
+    if(matchLength - LZ_MIN_MATCH >= 15)
+      editorLzPutLength(out, &o, matchLength - LZ_MIN_MATCH - 15);
+  }
+  return o;
+}
+
+/*
+  * Compress `size` bytes into `dst`, which must hold
+  * `editorCompressBound(size)` bytes
+*/
+int editorCompress(const char* src, int size, char* dst) {
+  static int table[1 << LZ_HASH_BITS];
+  unsigned char* out = (unsigned char*)dst;
+  memset(table, 0, sizeof(table));
+
+  int anchor = 0;
+  int o = 0;
+  int i = 0;
+  while(i + LZ_MIN_MATCH <= size) {
+    uint32_t sequence;
+    memcpy(&sequence, &src[i], sizeof(sequence));
+    unsigned int h = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+    int candidate = table[h] - 1;
+    table[h] = i + 1;
+
+    if(candidate >= 0 && i - candidate <= 0xffff &&
+        !memcmp(&src[candidate], &src[i], LZ_MIN_MATCH)) {
+      int length = LZ_MIN_MATCH;
+      while(i + length < size && src[candidate + length] == src[i + length])
+        length++;
+      o = editorLzSequence(out, o, &src[anchor], i - anchor, i - candidate,
+          length);
+      i += length;
+      anchor = i;
+    } else {
+      i++;
+    }
+  }
+  return editorLzSequence(out, o, &src[anchor], size - anchor, 0, 0);
+}
+
+/*
+  * Decompress into `dst`, which holds `size` bytes.
+  * Return the number of bytes produced.
+*/
+int editorDecompress(const char* src, int compressedSize, char* dst,
+    int size) {
+  const unsigned char* in = (const unsigned char*)src;
+  int i = 0;
+  int o = 0;
+  while(i < compressedSize) {
+    int token = in[i++];
+    int literalLength = token >> 4;
+    if(literalLength == 15)
+      literalLength += editorLzGetLength(in, &i, compressedSize);
+    if(o + literalLength > size || i + literalLength > compressedSize)
+      return -1;
+    memcpy(&dst[o], &in[i], literalLength);
+    o += literalLength;
+    i += literalLength;
+    if(i >= compressedSize) break;
+    if(i + 2 > compressedSize) return -1;
+
+    int offset = in[i] | (in[i + 1] << 8);
+    i += 2;
+    int matchLength = (token & 15) + LZ_MIN_MATCH;
+    if((token & 15) == 15)
+      matchLength += editorLzGetLength(in, &i, compressedSize);
+    if(offset == 0 || offset > o || o + matchLength > size) return -1;
+    /*
+      * Matches may overlap what they produce, so copy
+      * byte by byte
+    */
+    for(int j = 0; j < matchLength; ++j, ++o)
+      dst[o] = dst[o - offset];
+  }
+  return o;
+}
+
+/*
+  * The last decompressed block is kept around, since
+  * rows of the same block tend to be read together
+*/
+struct coldCache {
+  struct coldBlock* block;
+  char* data;
+  int capacity;
+};
+
+static struct coldCache coldCache = {NULL, NULL, 0};
+
+/*
+  * Cold blocks written out to make room, in a temporary
+  * file that is unlinked as soon as it is made. The space
+  * of blocks released later is not reused, the file goes
+  * away with the editor.
+*/
+struct spillFile {
+  int fd;
+  off_t size;
+  size_t bytes;
+};
+
+static struct spillFile spill = {-1, 0, 0};
+
+/*
+  * Decompress a block into `out`, which holds its
+  * `size` bytes, reading it back from the spill file
+  * first when it was written out. Safe to call from
+  * several threads at once.
+*/
+int editorColdBlockRead(struct coldBlock* block, char* out) {
+  if(block->data)
+    return editorDecompress(block->data, block->compressedSize, out,
+        block->size);
+  char* data = malloc(block->compressedSize ? block->compressedSize : 1);
+  int size = -1;
+  if(pread(spill.fd, data, block->compressedSize, block->spillOffset) ==
+      block->compressedSize)
+    size = editorDecompress(data, block->compressedSize, out, block->size);
+  free(data);
+  return size;
+}
+
+const char* editorColdBlockData(struct coldBlock* block) {
+  if(coldCache.block == block) return coldCache.data;
+  if(block->size > coldCache.capacity) {
+    coldCache.data = realloc(coldCache.data, block->size);
+    coldCache.capacity = block->size;
+  }
+  if(editorColdBlockRead(block, coldCache.data) != block->size)
+    die("decompress");
+  coldCache.block = block;
+  return coldCache.data;
+}
+
+void editorColdRelease(struct editorBuffer* buf, struct coldBlock* block) {
+  if(--block->refs > 0) return;
+  if(block->data) buf->memory[MEM_COLD] -= block->compressedSize;
+  else spill.bytes -= block->compressedSize;
+  buf->memory[MEM_COLD] -= sizeof(struct coldBlock);
+  if(coldCache.block == block) coldCache.block = NULL;
+  free(block->data);
+  free(block);
+}
+
+/*
+  * Write the compressed text of a block to the spill
+  * file and free it. Return -1 when it stays in memory.
+*/
+int editorSpillBlock(struct editorBuffer* buf, struct coldBlock* block) {
+  if(block->data == NULL) return 0;
+  if(spill.fd == -1) {
+    const char* dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/kilo-spill-XXXXXX",
+        dir && *dir ? dir : "/tmp");
+    spill.fd = mkstemp(path);
+    if(spill.fd == -1) return -1;
+    unlink(path);
+  }
+  if(pwrite(spill.fd, block->data, block->compressedSize, spill.size) !=
+      block->compressedSize)
+    return -1;
+  block->spillOffset = spill.size;
+  spill.size += block->compressedSize;
+  spill.bytes += block->compressedSize;
+  buf->memory[MEM_COLD] -= block->compressedSize;
+  free(block->data);
+  block->data = NULL;
+  return 0;
+}
+
+void editorTextRelease(struct editorBuffer* buf, struct textBlock* block) {
+  if(--block->refs > 0) return;
+  buf->memory[MEM_TEXT] -= block->size + sizeof(struct textBlock);
+  free(block->data);
+  free(block);
+}
+
+/*
+  * Give a row text of its own before it is changed
+*/
+void editorRowOwnText(struct editorBuffer* buf, erow* row) {
+  if(row->text == NULL) return;
+  char* chars = malloc(row->size + 1);
+  memcpy(chars, row->chars, row->size);
+  chars[row->size] = '\0';
+  row->chars = chars;
+  editorTextRelease(buf, row->text);
+  row->text = NULL;
+  buf->texts[row->idx] = chars;
+  buf->memory[MEM_TEXT] += row->size + 1;
+}
+
+void editorRowFreeText(struct editorBuffer* buf, erow* row) {
+  if(row->text) editorTextRelease(buf, row->text);
+  else free(row->chars);
+  row->text = NULL;
+  row->chars = NULL;
+}
+
+/*
+  * Rows from `i`, which must be resident, on whose text
+  * lies back to back in memory, as rows of a text block
+  * do until they are edited. Return the end of the run
+  * and set `*bytes` to the length it spans, NULs
+  * included.
+*/
+int editorTextRun(struct editorBuffer* buf, int i, int* bytes) {
+  const char* next = buf->texts[i];
+  int end = i;
+  while(end < buf->numRows && buf->texts[end] == next) {
+    next += buf->sizes[end] + 1;
+    end++;
+  }
+  *bytes = next - buf->texts[i];
+  return end;
+}
+
+/*
+  * The text of a row, resident or not. The pointer to
+  * a cold row's text is only good until another block
+  * is decompressed.
+*/
+const char* editorRowText(erow* row) {
+  if(row->cold == NULL) return row->chars;
+  return editorColdBlockData(row->cold) + row->coldOffset;
+}
+
+/*
+  * Count the words of pending rows, `KILO_COUNT_BYTES`
+  * of text at a time, for the first buffer that has
+  * any. Return 1 when some were counted.
+*/
+int editorCountPending() {
+  for(int b = 0; b < E.numBuffers; ++b) {
+    struct editorBuffer* buf = E.buffers[b];
+    struct bufferStats* stats = &buf->stats;
+    if(stats->uncounted == 0) continue;
+    long long bytes = 0;
+    int i = stats->countFrom;
+    for(int seen = 0; seen < buf->numRows && stats->uncounted &&
+        bytes < KILO_COUNT_BYTES; ++seen, ++i) {
+      if(i >= buf->numRows) i = 0;
+      erow* row = &buf->row[i];
+      if(row->wordCount >= 0) continue;
+      row->wordCount = editorCountWords(editorRowText(row), row->size);
+      stats->words += row->wordCount;
+      stats->uncounted--;
+      bytes += row->size;
+    }
+    stats->countFrom = i;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+  * Bring only the text of a cold row back into memory
+*/
+void editorRowThawText(struct editorBuffer* buf, erow* row) {
+  if(row->cold == NULL) return;
+  row->chars = malloc(row->size + 1);
+  memcpy(row->chars, editorRowText(row), row->size);
+  row->chars[row->size] = '\0';
+  editorColdRelease(buf, row->cold);
+  row->cold = NULL;
+  buf->texts[row->idx] = row->chars;
+  editorRowAccount(buf, row, 1);
+}
+
+/*
+  * Bring a cold row back into memory, or render a
+  * pending one, before it is looked at or edited
+*/
+void editorRowThaw(struct editorBuffer* buf, erow* row) {
+  if(row->cold) editorRowThawText(buf, row);
+  else if(!editorRowIsPending(row)) return;
+  editorRowAccount(buf, row, -1);
+  editorUpdateRow(buf, row);
+  editorRowAccount(buf, row, 1);
+}
+
+/*
+  * Render and highlight the whole of any row into the
+  * scratch buffers, leaving the state it ends in in
+  * `state`. Return the size of the render.
+*/
+int editorScratchRow(struct editorBuffer* buf, erow* row, char** render,
+    unsigned char** highlight, struct highlightState* state) {
+  const char* text = editorRowText(row);
+  int capacity = row->size + editorCountTabs(text, row->size) *
+    (KILO_TAB_STOP - 1) + 1;
+  editorScratch(capacity, render, highlight);
+
+  int column;
+  int rsize = editorRenderText(text, row->size, 0, 0, *render, &column);
+  (*render)[rsize] = '\0';
+  editorRowStartState(buf, row, state);
+  editorHighlightText(buf->syntax, *render, rsize, *highlight, state);
+  return rsize;
+}
+
+/*
+  * Highlight a cold or pending row without thawing it,
+  * only to learn the state it ends in
+*/
+int editorHighlightColdRow(struct editorBuffer* buf, erow* row) {
+  char* render;
+  unsigned char* highlight;
+  struct highlightState state;
+  int rsize = editorScratchRow(buf, row, &render, &highlight, &state);
+  editorIndexWords(buf, row, render, highlight, rsize);
+  struct bracketSummary brackets;
+  editorBracketScan(render, highlight, rsize, &brackets);
+  editorRowSetBrackets(buf, row, &brackets);
+
+  int changed = (row->hlOpenComment != state.inComment);
+  row->hlOpenComment = state.inComment;
+  return changed;
+}
+
+/*
+  * Compress the resident rows among `first..last` into
+  * one block and drop their render and highlight
+*/
+void editorFreezeRows(struct editorBuffer* buf, int first, int last) {
+  int total = 0;
+  int count = 0;
+  for(int i = first; i <= last; ++i) {
+    if(buf->row[i].cold) continue;
+    total += buf->row[i].size;
+    count++;
+  }
+  if(count == 0) return;
+
+  char* text = malloc(total ? total : 1);
+  int offset = 0;
+  for(int i = first; i <= last; ++i) {
+    if(buf->row[i].cold) continue;
+    memcpy(&text[offset], buf->row[i].chars, buf->row[i].size);
+    offset += buf->row[i].size;
+  }
+
+  struct coldBlock* block = malloc(sizeof(struct coldBlock));
+  block->data = malloc(editorCompressBound(total));
+  block->compressedSize = editorCompress(text, total, block->data);
+  block->data = realloc(block->data, block->compressedSize);
+  block->size = total;
+  block->refs = count;
+  buf->memory[MEM_COLD] += block->compressedSize + sizeof(struct coldBlock);
+  free(text);
+
+  offset = 0;
+  for(int i = first; i <= last; ++i) {
+    erow* row = &buf->row[i];
+    if(row->cold) continue;
+    editorRowAccount(buf, row, -1);
+    if(row->chunks) editorFreeChunks(buf, row);
+    editorRowFreeText(buf, row);
+    free(row->render);
+    editorFreeSpans(buf, row);
+    row->render = NULL;
+    row->rsize = 0;
+    row->cold = block;
+    row->coldOffset = offset;
+    buf->texts[i] = NULL;
+    offset += row->size;
+  }
+}
+
+/*
+  * Drop the render and highlight of the resident rows
+  * among `first..last`. They are left pending, like rows
+  * taken from a line index, and rendered again when
+  * they are looked at.
+*/
+void editorDropRender(struct editorBuffer* buf, int first, int last) {
+  for(int i = first; i <= last; ++i) {
+    erow* row = &buf->row[i];
+    if(row->cold || editorRowIsPending(row)) continue;
+    editorRowAccount(buf, row, -1);
+    if(row->chunks) editorFreeChunks(buf, row);
+    free(row->render);
+    row->render = NULL;
+    row->rsize = 0;
+    editorFreeSpans(buf, row);
+    editorRowAccount(buf, row, 1);
+  }
+}
+
+/*
+  * Write the cold blocks of the rows among `first..last`
+  * out to the spill file
+*/
+void editorSpillRows(struct editorBuffer* buf, int first, int last) {
+  for(int i = first; i <= last; ++i) {
+    struct coldBlock* block = buf->row[i].cold;
+    if(block && block->data && editorSpillBlock(buf, block) == -1) return;
+  }
+}
+
+/*
+  * The bytes a buffer uses, in all and by use in `usage`
+  * unless it is NULL
+*/
+size_t editorBufferMemory(struct editorBuffer* buf, size_t* usage) {
+  size_t parts[MEM_KINDS];
+  memcpy(parts, buf->memory, sizeof(parts));
+  parts[MEM_INDEX] += sizeof(struct wordNode) * buf->words.capacity +
+    (buf->words.cache ? sizeof(struct wordCacheEntry) * KILO_WORD_CACHE : 0) +
+    sizeof(struct bracketSummary) * 2 * buf->brackets.leaves +
+    sizeof(int) * buf->wrap.capacity +
+    sizeof(struct diskBlock) * buf->diskCapacity;
+  parts[MEM_ROWS] = (sizeof(erow) + sizeof(int) + sizeof(char*)) *
+    buf->numRows;
+
+  size_t total = 0;
+  for(int k = 0; k < MEM_KINDS; ++k) {
+    total += parts[k];
+    if(usage) usage[k] += parts[k];
+  }
+  return total;
+}
+
+size_t editorMemoryUsage() {
+  size_t total = 0;
+  for(int i = 0; i < E.numBuffers; ++i)
+    total += editorBufferMemory(E.buffers[i], NULL);
+  return total;
+}
+
+/*
+  * Print a byte count the short way, as in `2.5M` or
+  * `125M`
+*/
+char* editorFormatSize(size_t bytes, char* out, int size) {
+  const char* units = "KMGT";
+  if(bytes < 1024) {
+    snprintf(out, size, "%zu", bytes);
+    return out;
+  }
+  double value = bytes / 1024.0;
+  int unit = 0;
+  while(value >= 1024 && units[unit + 1]) {
+    value /= 1024;
+    unit++;
+  }
+  snprintf(out, size, value < 10 ? "%.1f%c" : "%.0f%c", value, units[unit]);
+  return out;
+}
+
+/*
+  * Tell where the memory of all buffers goes
+*/
+void editorShowMemory() {
+  size_t usage[MEM_KINDS] = {0};
+  size_t total = 0;
+  for(int i = 0; i < E.numBuffers; ++i)
+    total += editorBufferMemory(E.buffers[i], usage);
+
+  char sizes[MEM_KINDS + 3][16];
+  for(int k = 0; k < MEM_KINDS; ++k)
+    editorFormatSize(usage[k], sizes[k], sizeof(sizes[k]));
+  editorFormatSize(total, sizes[MEM_KINDS], sizeof(sizes[0]));
+  editorFormatSize(E.memoryBudget, sizes[MEM_KINDS + 1], sizeof(sizes[0]));
+  editorFormatSize(spill.bytes, sizes[MEM_KINDS + 2], sizeof(sizes[0]));
+  editorSetStatusMessage("mem %s/%s text %s render %s hl %s index %s "
+      "cold %s spill %s rows %s", sizes[MEM_KINDS],
+      E.memoryBudget ? sizes[MEM_KINDS + 1] : "-", sizes[MEM_TEXT],
+      sizes[MEM_RENDER], sizes[MEM_HIGHLIGHT], sizes[MEM_INDEX],
+      sizes[MEM_COLD], sizes[MEM_KINDS + 2], sizes[MEM_ROWS]);
+}
+
+/*
+  * Whether a group of rows is close to a window showing
+  * it or was edited lately
+*/
+int editorRowsAreHot(struct editorBuffer* buf, int first, int last) {
+  for(int i = 0; i < E.numViews; ++i) {
+    struct editorView* view = E.views[i];
+    if(view->buf != buf) continue;
+    int margin = view->screenRows * 2;
+    if(last >= view->rowOff - margin &&
+        first <= view->rowOff + view->screenRows + margin)
+      return 1;
+    if(view->cy >= first && view->cy <= last) return 1;
+  }
+  for(int i = first; i <= last; ++i) {
+    unsigned int lastEdit = buf->row[i].lastEdit;
+    if(lastEdit && E.editClock - lastEdit < KILO_RECENT_EDITS) return 1;
+  }
+  return 0;
+}
+
+/*
+  * Keep the memory used by the buffers under the budget
+  * given with `--memory-budget`, working on groups of
+  * rows that are far from every window and have not
+  * been edited lately. Once over budget, their render
+  * and highlight are dropped first, then their text is
+  * compressed, then the compressed text is written out
+  * to the spill file, each step going over all buffers
+  * before the next one is taken, until usage is back
+  * under three quarters of the budget.
+*/
+void editorEnforceMemoryBudget() {
+  static time_t lastPass = 0;
+  if(E.memoryBudget == 0 || editorMemoryUsage() <= E.memoryBudget) return;
+  time_t now = time(NULL);
+  if(now == lastPass) return;
+  lastPass = now;
+
+  size_t target = E.memoryBudget / 4 * 3;
+  void (*steps[])(struct editorBuffer*, int, int) = {
+    editorDropRender, editorFreezeRows, editorSpillRows
+  };
+  for(int step = 0; step < 3; ++step) {
+    for(int b = 0; b < E.numBuffers; ++b) {
+      struct editorBuffer* buf = E.buffers[b];
+      for(int first = 0; first < buf->numRows;
+          first += KILO_COLD_BLOCK_ROWS) {
+        int last = first + KILO_COLD_BLOCK_ROWS - 1;
+        if(last >= buf->numRows) last = buf->numRows - 1;
+        if(editorRowsAreHot(buf, first, last)) continue;
+        steps[step](buf, first, last);
+        if(editorMemoryUsage() <= target) return;
+      }
+    }
+  }
+}
+
+/*
+  * Clear everything of a new row but its `idx`, `size`,
+  * `chars` and `text`
+*/
+void editorInitRow(erow* row) {
+  row->rsize = 0;
+  row->render = NULL;
+  row->spans = NULL;
+  row->numSpans = 0;
+  row->chunks = NULL;
+  row->numChunks = 0;
+  row->validChunks = 0;
+  row->cold = NULL;
+  row->coldOffset = 0;
+  row->lastEdit = 0;
+  row->hlOpenComment = 0;
+  row->words = NULL;
+  row->numWords = 0;
+  row->brackets.sum = row->brackets.min = 0;
+  row->columns = -1;
+  row->staleHighlight = 0;
+  row->wordCount = -1;
+  row->changed = 0;
+}
+
+/*
+  * Fill in a new row whose `idx`, `size`, `chars` and
+  * `text` are set, then render and highlight it
+*/
+void editorSetupRow(struct editorBuffer* buf, erow* row) {
+  int at = row->idx;
+  editorInitRow(row);
+  /*
+    * Start out in the state of the row above, so the
+    * rows below are only revisited when this one ends
+    * in a different state
+  */
+  row->hlOpenComment = at > 0 ? buf->row[at - 1].hlOpenComment : 0;
+  editorUpdateRow(buf, row);
+  editorRowAccount(buf, row, 1);
+  editorRowCount(buf, row, 1);
+}
+
+/*
+  * To handle multiple lines
+*/
+void editorInsertRow(struct editorBuffer* buf, int at, char* s,
+    size_t length) {
+  if(at < 0 || at > buf->numRows) return;
+
+  editorGrowRows(buf, 1);
+  memmove(&buf->row[at + 1], &buf->row[at],
+      sizeof(erow) * (buf->numRows - at));
+  memmove(&buf->sizes[at + 1], &buf->sizes[at],
+      sizeof(int) * (buf->numRows - at));
+  memmove(&buf->texts[at + 1], &buf->texts[at],
+      sizeof(char*) * (buf->numRows - at));
+  for(int j = at + 1; j <= buf->numRows; ++j) buf->row[j].idx++;
+  buf->numRows++;
+  editorRowsMoved(buf, at);
+
+  erow* row = &buf->row[at];
+  row->idx = at;
+  row->size = length;
+  row->chars = malloc(length + 1);
+  memcpy(row->chars, s, length);
+  row->chars[length] = '\0';
+  row->text = NULL;
+  row->cold = NULL;
+  editorSyncRow(buf, row);
+  editorSetupRow(buf, row);
+  editorRowTouch(buf, row);
+
+  buf->dirty++;
+}
+
+/*
+  * Fill the rows `at..at+count-1`, which have been made
+  * room for, taking their text from `block` where it is
+  * stored one row after another. With `states` the rows
+  * are left pending in the highlight state they are
+  * known to end in, with the bracket sum and minimum
+  * given in pairs in `brackets`. Else they are rendered
+  * and highlighted now.
+*/
+void editorPlaceBlockRows(struct editorBuffer* buf, int at,
+    struct textBlock* block, int* lengths, int count,
+    const unsigned char* states, const int32_t* brackets) {
+  buf->memory[MEM_TEXT] += block->size + sizeof(struct textBlock);
+  block->refs = count;
+
+  int offset = 0;
+  for(int k = 0; k < count; ++k) {
+    erow* row = &buf->row[at + k];
+    row->idx = at + k;
+    row->size = lengths[k];
+    row->chars = &block->data[offset];
+    row->text = block;
+    row->cold = NULL;
+    offset += lengths[k] + 1;
+    editorSyncRow(buf, row);
+    if(states) {
+      editorInitRow(row);
+      row->hlOpenComment = states[k];
+      struct bracketSummary summary = {brackets[2 * k], brackets[2 * k + 1]};
+      editorRowSetBrackets(buf, row, &summary);
+      editorRowCount(buf, row, 1);
+    } else {
+      /*
+        * The rows below are not filled in yet, so a
+        * changed end state is not carried on to them
+      */
+      editorInitRow(row);
+      row->hlOpenComment = row->idx > 0 ?
+        buf->row[row->idx - 1].hlOpenComment : 0;
+      editorRenderRow(buf, row);
+      editorHighlightRow(buf, row);
+      editorRowAccount(buf, row, 1);
+      editorRowCount(buf, row, 1);
+    }
+  }
+}
+
+/*
+  * Add `count` rows from `block` to the end of a buffer
+*/
+void editorAppendBlockRows(struct editorBuffer* buf,
+    struct textBlock* block, int* lengths, int count,
+    const unsigned char* states, const int32_t* brackets) {
+  editorGrowRows(buf, count);
+  buf->numRows += count;
+  buf->stats.savedRows += count;
+  editorPlaceBlockRows(buf, buf->numRows - count, block, lengths, count,
+      states, brackets);
+}
+
+/*
+ * When we delete '\n' we need to free the row
+*/
+void editorFreeRow(struct editorBuffer* buf, erow* row) {
+  editorRowAccount(buf, row, -1);
+  editorRowCount(buf, row, -1);
+  if(row->chunks) editorFreeChunks(buf, row);
+  if(row->cold) editorColdRelease(buf, row->cold);
+  free(row->render);
+  editorRowFreeText(buf, row);
+  editorFreeSpans(buf, row);
+  editorFreeWords(buf, row);
+}
+
+/*
+  * Insert a single character into an `erow` at
+  * a given position
+*/
+void editorRowInsertChar(struct editorBuffer* buf, erow* row, int at, int c) {
+  editorRowThaw(buf, row);
+  editorRowOwnText(buf, row);
+  if(at < 0 || at > row->size) at = row->size;
+  editorRowUncount(buf, row, at, at);
+  editorRowAccount(buf, row, -1);
+  row->chars = realloc(row->chars, row->size + 2);
+  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  row->size++;
+  row->chars[at] = c;
+  editorRowChanged(buf, row, at, 1);
+  editorRowAccount(buf, row, 1);
+  buf->dirty++;
+}
+
+/*
+  * Insert `length` bytes into a row at a given position
+*/
+void editorRowInsertString(struct editorBuffer* buf, erow* row, int at,
+    const char* s, int length) {
+  editorRowThaw(buf, row);
+  editorRowOwnText(buf, row);
+  if(at < 0 || at > row->size) at = row->size;
+  editorRowUncount(buf, row, at, at);
+  editorRowAccount(buf, row, -1);
+  row->chars = realloc(row->chars, row->size + length + 1);
+  memmove(&row->chars[at + length], &row->chars[at], row->size - at + 1);
+  memcpy(&row->chars[at], s, length);
+  row->size += length;
+  editorRowChanged(buf, row, at, length);
+  editorRowAccount(buf, row, 1);
+  buf->dirty++;
+}
+
+/*
+ * Delete `length` bytes in the current row
+*/
+void editorRowDeleteChars(struct editorBuffer* buf, erow* row, int at,
+    int length) {
+  if(at < 0 || at >= row->size) return;
+  if(at + length > row->size) length = row->size - at;
+  editorRowThaw(buf, row);
+  editorRowOwnText(buf, row);
+  editorRowUncount(buf, row, at, at + length);
+  editorRowAccount(buf, row, -1);
+  memmove(&row->chars[at], &row->chars[at + length],
+      row->size - at - length + 1);
+  row->size -= length;
+  editorRowChanged(buf, row, at, -length);
+  editorRowAccount(buf, row, 1);
+  buf->dirty++;
+}
+
+/*
+ * Delete a character in the current row
+*/
+void editorRowDeleteChar(struct editorBuffer* buf, erow* row, int at) {
+  editorRowDeleteChars(buf, row, at, 1);
+}
+
+void editorInsertChar(int c) {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(view->cy == buf->numRows) {
+    editorInsertRow(buf, buf->numRows, "", 0);
+  }
+  editorRowInsertChar(buf, &buf->row[view->cy], view->cx, c);
+  view->cx++;
+}
+
+void editorInsertNewline() {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(view->cx == 0) {
+    editorInsertRow(buf, view->cy, "", 0);
+  } else {
+    erow* row = &buf->row[view->cy];
+    editorRowThaw(buf, row);
+    editorInsertRow(buf, view->cy + 1, &row->chars[view->cx],
+        row->size - view->cx);
+    row = &buf->row[view->cy];
+    editorRowOwnText(buf, row);
+    editorRowUncount(buf, row, view->cx, row->size);
+    editorRowAccount(buf, row, -1);
+    int removed = row->size - view->cx;
+    row->size = view->cx;
+    row->chars[row->size] = '\0';
+    editorRowChanged(buf, row, view->cx, -removed);
+    editorRowAccount(buf, row, 1);
+  }
+  view->cy++;
+  view->cx = 0;
+}
+
+void editorRowAppendString(struct editorBuffer* buf, erow* row, char* s,
+    size_t length) {
+  editorRowThaw(buf, row);
+  editorRowOwnText(buf, row);
+  editorRowUncount(buf, row, row->size, row->size);
+  editorRowAccount(buf, row, -1);
+  row->chars = realloc(row->chars, row->size + length + 1);
+  memcpy(&row->chars[row->size], s, length);
+  row->size += length;
+  row->chars[row->size] = '\0';
+  editorRowChanged(buf, row, row->size - length, length);
+  editorRowAccount(buf, row, 1);
+  buf->dirty++;
+}
+
+/*
+  * Make a row its first `keep` bytes followed by the
+  * `length` bytes of `s`, in one allocation. The row is
+  * rendered but not highlighted.
+*/
+void editorRowReplaceTail(struct editorBuffer* buf, erow* row, int keep,
+    const char* s, int length) {
+  editorRowThawText(buf, row);
+  char* chars = malloc(keep + length + 1);
+  memcpy(chars, row->chars, keep);
+  memcpy(&chars[keep], s, length);
+  chars[keep + length] = '\0';
+
+  editorRowAccount(buf, row, -1);
+  editorRowFreeText(buf, row);
+  row->chars = chars;
+  row->size = keep + length;
+  editorRowEdited(buf, row);
+  editorSyncRow(buf, row);
+  editorRenderRow(buf, row);
+  editorRowAccount(buf, row, 1);
+  buf->dirty++;
+}
+
+/*
+ * When the cursor is at the start of the line, we
+ * hit the blackspace and delete the row
+*/
+void editorDeleteRow(struct editorBuffer* buf, int at) {
+  if(at < 0 || at >= buf->numRows) return;
+  editorFreeRow(buf, &buf->row[at]);
+  memmove(&buf->row[at], &buf->row[at + 1], sizeof(erow)
+      * (buf->numRows - at - 1));
+  memmove(&buf->sizes[at], &buf->sizes[at + 1], sizeof(int)
+      * (buf->numRows - at - 1));
+  memmove(&buf->texts[at], &buf->texts[at + 1], sizeof(char*)
+      * (buf->numRows - at - 1));
+  for(int j = at; j < buf->numRows - 1; ++j) buf->row[j].idx--;
+  buf->numRows--;
+  editorRowsMoved(buf, at);
+  /*
+    * The row below now follows a different row, its
+    * multi-line comment state may have changed
+  */
+  if(at < buf->numRows) editorUpdateSyntax(buf, &buf->row[at]);
+  buf->dirty++;
+}
+
+/*
+ * A wrapper function
+*/
+void editorDeleteChar() {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(view->cy == buf->numRows) return;
+  if(view->cx == 0 && view->cy == 0) return;
+  erow *row = &buf->row[view->cy];
+  editorRowThaw(buf, row);
+  if(view->cx > 0) {
+    /*
+      * Remove the whole UTF-8 sequence before the cursor
+    */
+    int at = view->cx - 1;
+    while(at > 0 && editorIsContinuationByte(row->chars[at])) at--;
+    editorRowDeleteChars(buf, row, at, view->cx - at);
+    view->cx = at;
+  } else {
+    // go the to the next upper line
+    view->cx = buf->row[view->cy - 1].size;
+    editorRowAppendString(buf, &buf->row[view->cy - 1], row->chars,
+        row->size);
+    editorDeleteRow(buf, view->cy);
+    view->cy--;
+  }
+}
+
+/*
+  * Text cut or copied, as the lines it spans, back to
+  * back and each ended by a NUL like in a text block.
+  * The first and the last line are parts of rows. The
+  * ones between are whole rows and keep the state they
+  * ended in and their bracket sums, so a yank can put
+  * them back without highlighting them as long as they
+  * start out in `startState` again.
+*/
+struct killEntry {
+  char* data;
+  int* offsets;
+  int* lengths;
+  unsigned char* states;
+  int32_t* brackets;
+  int numLines;
+  int startState;
+};
+
+/*
+  * The last `KILO_KILL_RING` cuts and copies. The text
+  * of the last yank runs from `yankRow`, `yankCx` to the
+  * cursor, as long as the cursor and the buffer stay as
+  * the yank left them.
+*/
+struct killRing {
+  struct killEntry entries[KILO_KILL_RING];
+  int count;
+  int latest;
+  struct editorBuffer* yankBuf;
+  int yankEntry;
+  int yankRow;
+  int yankCx;
+  int yankEndRow;
+  int yankEndCx;
+  int yankDirty;
+};
+
+static struct killRing killRing;
+
+/*
+  * Keep a position within the text of a buffer
+*/
+void editorClampPosition(struct editorBuffer* buf, int* cy, int* cx) {
+  if(*cy >= buf->numRows) {
+    *cy = buf->numRows - 1;
+    *cx = buf->sizes[*cy];
+  } else if(*cx > buf->sizes[*cy]) {
+    *cx = buf->sizes[*cy];
+  }
+}
+
+/*
+  * The region between the mark and the cursor, start
+  * first. Return 0 when there is none.
+*/
+int editorRegion(struct editorView* view, int* r1, int* c1, int* r2,
+    int* c2) {
+  struct editorBuffer* buf = view->buf;
+  if(!view->markSet || view->numCursors || buf->numRows == 0) return 0;
+  int markRow = view->markRow;
+  int markCx = view->markCx;
+  int cy = view->cy;
+  int cx = view->cx;
+  editorClampPosition(buf, &markRow, &markCx);
+  editorClampPosition(buf, &cy, &cx);
+  int markFirst = markRow < cy || (markRow == cy && markCx < cx);
+  *r1 = markFirst ? markRow : cy;
+  *c1 = markFirst ? markCx : cx;
+  *r2 = markFirst ? cy : markRow;
+  *c2 = markFirst ? cx : markCx;
+  return 1;
+}
+
+void editorFreeKillEntry(struct killEntry* entry) {
+  free(entry->data);
+  free(entry->offsets);
+  free(entry->lengths);
+  free(entry->states);
+  free(entry->brackets);
+  memset(entry, 0, sizeof(*entry));
+}
+
+/*
+  * Copy the text from `r1`, `c1` to `r2`, `c2` into the
+  * kill ring. Cold rows are read without thawing them.
+*/
+void editorKillSave(struct editorBuffer* buf, int r1, int c1, int r2,
+    int c2) {
+  int slot = killRing.count ? (killRing.latest + 1) % KILO_KILL_RING : 0;
+  struct killEntry* entry = &killRing.entries[slot];
+  editorFreeKillEntry(entry);
+  killRing.latest = slot;
+  if(killRing.count < KILO_KILL_RING) killRing.count++;
+
+  int n = r2 - r1 + 1;
+  entry->numLines = n;
+  entry->offsets = malloc(sizeof(int) * n);
+  entry->lengths = malloc(sizeof(int) * n);
+  entry->states = malloc(n);
+  entry->brackets = malloc(sizeof(int32_t) * 2 * n);
+  entry->startState = buf->row[r1].hlOpenComment;
+
+  int size = 0;
+  for(int i = r1; i <= r2; ++i) {
+    int start = i == r1 ? c1 : 0;
+    int end = i == r2 ? c2 : buf->sizes[i];
+    entry->offsets[i - r1] = size;
+    entry->lengths[i - r1] = end - start;
+    size += end - start + 1;
+  }
+  entry->data = malloc(size);
+  for(int i = r1; i <= r2; ++i) {
+    erow* row = &buf->row[i];
+    int k = i - r1;
+    memcpy(&entry->data[entry->offsets[k]],
+        editorRowText(row) + (i == r1 ? c1 : 0), entry->lengths[k]);
+    entry->data[entry->offsets[k] + entry->lengths[k]] = '\0';
+    entry->states[k] = row->hlOpenComment;
+    entry->brackets[2 * k] = row->brackets.sum;
+    entry->brackets[2 * k + 1] = row->brackets.min;
+  }
+}
+
+/*
+  * Remove the text from `r1`, `c1` to `r2`, `c2`. The
+  * rows in between go in one splice and only the row
+  * they are joined into is highlighted again, the rows
+  * below only while its end state differs from the one
+  * the last removed row ended in.
+*/
+void editorRemoveText(struct editorBuffer* buf, int r1, int c1, int r2,
+    int c2) {
+  if(r1 == r2) {
+    editorRowDeleteChars(buf, &buf->row[r1], c1, c2 - c1);
+    return;
+  }
+  erow* last = &buf->row[r2];
+  editorRowThawText(buf, last);
+  int endState = last->hlOpenComment;
+  erow* row = &buf->row[r1];
+  editorRowReplaceTail(buf, row, c1, &last->chars[c2], last->size - c2);
+
+  for(int i = r1 + 1; i <= r2; ++i) editorFreeRow(buf, &buf->row[i]);
+  int removed = r2 - r1;
+  int after = buf->numRows - r2 - 1;
+  memmove(&buf->row[r1 + 1], &buf->row[r2 + 1], sizeof(erow) * after);
+  memmove(&buf->sizes[r1 + 1], &buf->sizes[r2 + 1], sizeof(int) * after);
+  memmove(&buf->texts[r1 + 1], &buf->texts[r2 + 1], sizeof(char*) * after);
+  buf->numRows -= removed;
+  for(int j = r1 + 1; j < buf->numRows; ++j) buf->row[j].idx -= removed;
+  editorRowsMoved(buf, r1 + 1);
+
+  row->hlOpenComment = endState;
+  editorUpdateSyntax(buf, row);
+}
+
+/*
+  * Put a kill ring entry in at the cursor. The whole
+  * rows of the entry are spliced in at once from a
+  * single text block and keep their saved end states,
+  * so only the two rows at the ends are highlighted,
+  * unless the text now starts out in another state.
+*/
+void editorInsertText(struct editorView* view, struct killEntry* entry) {
+  struct editorBuffer* buf = view->buf;
+  if(view->cy == buf->numRows) editorInsertRow(buf, buf->numRows, "", 0);
+  int cy = view->cy;
+  erow* row = &buf->row[cy];
+  editorRowThawText(buf, row);
+  int at = view->cx < row->size ? view->cx : row->size;
+  int n = entry->numLines;
+  if(n == 1) {
+    editorRowInsertString(buf, row, at, entry->data, entry->lengths[0]);
+    view->cx = at + entry->lengths[0];
+    return;
+  }
+
+  int lastLength = entry->lengths[n - 1];
+  int size = lastLength + row->size - at;
+  char* tail = malloc(size + 1);
+  memcpy(tail, &entry->data[entry->offsets[n - 1]], lastLength);
+  memcpy(&tail[lastLength], &row->chars[at], row->size - at);
+  tail[size] = '\0';
+  int oldState = row->hlOpenComment;
+
+  editorGrowRows(buf, n - 1);
+  int after = buf->numRows - cy - 1;
+  memmove(&buf->row[cy + n], &buf->row[cy + 1], sizeof(erow) * after);
+  memmove(&buf->sizes[cy + n], &buf->sizes[cy + 1], sizeof(int) * after);
+  memmove(&buf->texts[cy + n], &buf->texts[cy + 1], sizeof(char*) * after);
+  buf->numRows += n - 1;
+  for(int j = cy + n; j < buf->numRows; ++j) buf->row[j].idx += n - 1;
+  editorRowsMoved(buf, cy + 1);
+
+  if(n > 2) {
+    struct textBlock* block = malloc(sizeof(struct textBlock));
+    block->size = entry->offsets[n - 1] - entry->offsets[1];
+    block->data = malloc(block->size);
+    memcpy(block->data, &entry->data[entry->offsets[1]], block->size);
+    editorPlaceBlockRows(buf, cy + 1, block, &entry->lengths[1], n - 2,
+        &entry->states[1], &entry->brackets[2]);
+    for(int i = cy + 1; i < cy + n - 1; ++i)
+      editorRowTouch(buf, &buf->row[i]);
+    buf->wordsPending = 1;
+  }
+
+  /*
+    * The last row ends where the row split here used to,
+    * and the rows below started out in that state. It is
+    * highlighted once the rows above it are.
+  */
+  erow* last = &buf->row[cy + n - 1];
+  last->idx = cy + n - 1;
+  last->size = size;
+  last->chars = tail;
+  last->text = NULL;
+  last->cold = NULL;
+  editorSyncRow(buf, last);
+  editorInitRow(last);
+  last->hlOpenComment = oldState;
+  editorRenderRow(buf, last);
+  editorRowAccount(buf, last, 1);
+  editorRowCount(buf, last, 1);
+  editorRowTouch(buf, last);
+
+  /*
+    * The middle rows kept the states they had when they
+    * were cut, which hold as long as the first row ends
+    * in the state it ended in then
+  */
+  row = &buf->row[cy];
+  editorRowReplaceTail(buf, row, at, entry->data, entry->lengths[0]);
+  row->hlOpenComment = entry->startState;
+  editorUpdateSyntax(buf, row);
+  editorUpdateSyntax(buf, &buf->row[cy + n - 1]);
+
+  view->cy = cy + n - 1;
+  view->cx = lastLength;
+}
+
+/*
+  * Copy the region to the kill ring, and cut it when
+  * `cut` is set
+*/
+void editorKillRegion(int cut) {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  int r1, c1, r2, c2;
+  if(!editorRegion(view, &r1, &c1, &r2, &c2)) {
+    editorSetStatusMessage("No region, set the mark with C-x SPACE");
+    return;
+  }
+  editorKillSave(buf, r1, c1, r2, c2);
+  if(cut) {
+    editorRemoveText(buf, r1, c1, r2, c2);
+    view->cy = r1;
+    view->cx = c1;
+  }
+  view->markSet = 0;
+  editorSetStatusMessage("%s %d lines", cut ? "Cut" : "Copied",
+      r2 - r1 + 1);
+}
+
+void editorYank(int entry) {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(killRing.count == 0) {
+    editorSetStatusMessage("Nothing to yank");
+    return;
+  }
+  view->markSet = 0;
+  killRing.yankBuf = buf;
+  killRing.yankEntry = entry;
+  killRing.yankRow = view->cy;
+  killRing.yankCx = view->cx;
+  if(view->cy < buf->numRows && view->cx > buf->sizes[view->cy])
+    killRing.yankCx = buf->sizes[view->cy];
+  editorInsertText(view, &killRing.entries[entry]);
+  killRing.yankEndRow = view->cy;
+  killRing.yankEndCx = view->cx;
+  killRing.yankDirty = buf->dirty;
+}
+
+/*
+  * Right after a yank, swap the yanked text for the
+  * entry before it in the ring
+*/
+void editorYankPop() {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(killRing.yankBuf != buf || buf->dirty != killRing.yankDirty ||
+      view->cy != killRing.yankEndRow || view->cx != killRing.yankEndCx) {
+    editorSetStatusMessage("Yank with C-y first");
+    return;
+  }
+  editorRemoveText(buf, killRing.yankRow, killRing.yankCx,
+      killRing.yankEndRow, killRing.yankEndCx);
+  view->cy = killRing.yankRow;
+  view->cx = killRing.yankCx;
+  editorYank((killRing.yankEntry + killRing.count - 1) % killRing.count);
+}
+
+/*
+  * Go back to a single cursor, the primary one
+*/
+void editorDropCursors(struct editorView* view) {
+  if(view->numCursors == 0) return;
+  view->cx = view->cursors[view->primary].cx;
+  view->cy = view->cursors[view->primary].cy;
+  free(view->cursors);
+  view->cursors = NULL;
+  view->numCursors = 0;
+}
+
+int editorCursorCompare(const void* a, const void* b) {
+  const struct editorCursor* x = a;
+  const struct editorCursor* y = b;
+  if(x->cy != y->cy) return x->cy < y->cy ? -1 : 1;
+  return (x->cx > y->cx) - (x->cx < y->cx);
+}
+
+/*
+  * Put the cursors back in order after they moved and
+  * merge the ones that met, following the primary one
+*/
+void editorSortCursors(struct editorView* view) {
+  struct editorCursor primary = view->cursors[view->primary];
+  qsort(view->cursors, view->numCursors, sizeof(struct editorCursor),
+      editorCursorCompare);
+  int count = 0;
+  for(int i = 0; i < view->numCursors; ++i) {
+    struct editorCursor* cursor = &view->cursors[i];
+    if(count && !editorCursorCompare(cursor, &view->cursors[count - 1]))
+      continue;
+    if(!editorCursorCompare(cursor, &primary)) view->primary = count;
+    view->cursors[count++] = *cursor;
+  }
+  view->numCursors = count;
+  view->cx = view->cursors[view->primary].cx;
+  view->cy = view->cursors[view->primary].cy;
+  if(count == 1) editorDropCursors(view);
+}
+
+/*
+  * Index of the first cursor on row `cy` or below
+*/
+int editorFirstCursor(struct editorView* view, int cy) {
+  int low = 0;
+  int high = view->numCursors;
+  while(low < high) {
+    int mid = (low + high) / 2;
+    if(view->cursors[mid].cy < cy) low = mid + 1;
+    else high = mid;
+  }
+  return low;
+}
+
+void editorSetMark() {
+  struct editorView* view = E.view;
+  view->markSet = 1;
+  view->markRow = view->cy;
+  view->markCx = view->cx;
+  view->markRx = view->rx;
+  editorSetStatusMessage("Mark set");
+}
+
+/*
+  * Put a cursor on every row between the column mark and
+  * the cursor, each selecting the columns between them
+*/
+void editorColumnCursors() {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(!view->markSet) {
+    editorSetStatusMessage("No mark, set one with C-x SPACE");
+    return;
+  }
+  int first = view->markRow < view->cy ? view->markRow : view->cy;
+  int last = view->markRow < view->cy ? view->cy : view->markRow;
+  if(last >= buf->numRows) last = buf->numRows - 1;
+  view->markSet = 0;
+  if(first >= last) return;
+
+  editorDropCursors(view);
+  view->numCursors = last - first + 1;
+  view->cursors = malloc(sizeof(struct editorCursor) * view->numCursors);
+  view->primary = view->cy <= last ? view->cy - first : last - first;
+  for(int i = first; i <= last; ++i) {
+    erow* row = &buf->row[i];
+    editorRowThawText(buf, row);
+    struct editorCursor* cursor = &view->cursors[i - first];
+    cursor->cy = i;
+    cursor->cx = editorTextOffsetAt(row->chars, row->size, 0, view->rx);
+    cursor->anchor = editorTextOffsetAt(row->chars, row->size, 0,
+        view->markRx);
+  }
+  view->cx = view->cursors[view->primary].cx;
+  view->cy = view->cursors[view->primary].cy;
+  editorSetStatusMessage("%d cursors, ESC to go back to one",
+      view->numCursors);
+}
+
+/*
+  * Move every cursor, within its row for left and right.
+  * Up and down keep the column each cursor is at.
+*/
+void editorMoveCursors(struct editorView* view, int key) {
+  struct editorBuffer* buf = view->buf;
+  for(int i = 0; i < view->numCursors; ++i) {
+    struct editorCursor* cursor = &view->cursors[i];
+    if(cursor->cy >= buf->numRows) cursor->cy = buf->numRows - 1;
+    erow* row = &buf->row[cursor->cy];
+    editorRowThawText(buf, row);
+    if(cursor->cx > row->size) cursor->cx = row->size;
+    switch(key) {
+      case ARROW_LEFT:
+        if(cursor->cx > 0) cursor->cx--;
+        while(cursor->cx > 0 &&
+            editorIsContinuationByte(row->chars[cursor->cx]))
+          cursor->cx--;
+        break;
+      case ARROW_RIGHT:
+        if(cursor->cx < row->size) cursor->cx++;
+        while(cursor->cx < row->size &&
+            editorIsContinuationByte(row->chars[cursor->cx]))
+          cursor->cx++;
+        break;
+      case HOME_KEY:
+        cursor->cx = 0;
+        break;
+      case END_KEY:
+        cursor->cx = row->size;
+        break;
+      case ARROW_UP:
+      case ARROW_DOWN: {
+          int cy = cursor->cy + (key == ARROW_UP ? -1 : 1);
+          if(cy < 0 || cy >= buf->numRows) break;
+          int rx = editorTextColumns(row->chars, cursor->cx, 0);
+          row = &buf->row[cy];
+          editorRowThawText(buf, row);
+          cursor->cy = cy;
+          cursor->cx = editorTextOffsetAt(row->chars, row->size, 0, rx);
+        }
+        break;
+    }
+    cursor->anchor = cursor->cx;
+  }
+  editorSortCursors(view);
+}
+
+/*
+  * Rebuild a row with a key applied at each of its
+  * `count` cursors, in a single allocation. The row is
+  * rendered but not highlighted. Return 0 when nothing
+  * changed.
+*/
+int editorEditRow(struct editorBuffer* buf, erow* row,
+    struct editorCursor* cursors, int count, int key) {
+  editorRowThawText(buf, row);
+  int insert = key != BACKSPACE && key != CTRL_KEY('h') && key != DEL_KEY;
+  char* chars = malloc(row->size + count + 1);
+  int edited = 0;
+  int out = 0;
+  int pos = 0;
+  for(int k = 0; k < count; ++k) {
+    struct editorCursor* cursor = &cursors[k];
+    int start = cursor->cx < cursor->anchor ? cursor->cx : cursor->anchor;
+    int end = cursor->cx < cursor->anchor ? cursor->anchor : cursor->cx;
+    if(end > row->size) end = row->size;
+    if(start < pos) start = pos;
+    if(end < start) end = start;
+    if(start == end && key == DEL_KEY && end < row->size) {
+      end++;
+      while(end < row->size && editorIsContinuationByte(row->chars[end]))
+        end++;
+    } else if(start == end && !insert && start > pos) {
+      start--;
+      while(start > pos && editorIsContinuationByte(row->chars[start]))
+        start--;
+    }
+    memcpy(&chars[out], &row->chars[pos], start - pos);
+    out += start - pos;
+    if(insert) chars[out++] = key;
+    if(insert || end > start) edited = 1;
+    cursor->cx = cursor->anchor = out;
+    pos = end;
+  }
+  if(!edited) {
+    free(chars);
+    return 0;
+  }
+  memcpy(&chars[out], &row->chars[pos], row->size - pos);
+  out += row->size - pos;
+  chars[out] = '\0';
+
+  editorRowAccount(buf, row, -1);
+  editorRowFreeText(buf, row);
+  row->chars = chars;
+  row->size = out;
+  editorRowEdited(buf, row);
+  editorSyncRow(buf, row);
+  editorRenderRow(buf, row);
+  editorRowAccount(buf, row, 1);
+  buf->dirty++;
+  return 1;
+}
+
+/*
+  * Type or delete at every cursor. Each row is rebuilt
+  * once with the edits of all its cursors, then the
+  * changed rows are highlighted in one pass. Deleting
+  * at the start of a row does not join rows here.
+*/
+void editorEditCursors(struct editorView* view, int key) {
+  struct editorBuffer* buf = view->buf;
+  int* rows = malloc(sizeof(int) * view->numCursors);
+  int numRows = 0;
+  int i = 0;
+  while(i < view->numCursors) {
+    int cy = view->cursors[i].cy;
+    int j = i;
+    while(j < view->numCursors && view->cursors[j].cy == cy) j++;
+    if(cy < buf->numRows &&
+        editorEditRow(buf, &buf->row[cy], &view->cursors[i], j - i, key))
+      rows[numRows++] = cy;
+    i = j;
+  }
+  editorHighlightRows(buf, rows, numRows);
+  free(rows);
+  view->cx = view->cursors[view->primary].cx;
+  view->cy = view->cursors[view->primary].cy;
+}
+
+/*
+  * Handle a key while the current window has several
+  * cursors. Return 0 when the key is left to the usual
+  * handling, which for most keys goes back to a single
+  * cursor first.
+*/
+int editorMultiKey(struct editorView* view, int c) {
+  switch(c) {
+    case ARROW_UP:
+    case ARROW_DOWN:
+    case ARROW_LEFT:
+    case ARROW_RIGHT:
+    case HOME_KEY:
+    case END_KEY:
+      editorMoveCursors(view, c);
+      return 1;
+    case BACKSPACE:
+    case CTRL_KEY('h'):
+    case DEL_KEY:
+      editorEditCursors(view, c);
+      return 1;
+    case '\x1b':
+      editorDropCursors(view);
+      return 1;
+    case CTRL_KEY('s'):
+    case CTRL_KEY('x'):
+    case CTRL_KEY('l'):
+      return 0;
+  }
+  if(c == '\t' || (c >= 32 && c < 256 && c != 127)) {
+    editorEditCursors(view, c);
+    return 1;
+  }
+  editorDropCursors(view);
+  return 0;
+}
+
+/*
+  * Complete the word before the cursor from the words
+  * of the buffer. Pressed again right away, replace
+  * the completion with the next word offered.
+*/
+void editorComplete() {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(view->cy >= buf->numRows) return;
+  erow* row = &buf->row[view->cy];
+  editorRowThaw(buf, row);
+
+  if(!(E.completion.count && E.completion.buf == buf &&
+        E.completion.row == view->cy &&
+        view->cx == E.completion.at + E.completion.length)) {
+    for(int i = 0; i < E.completion.count; ++i)
+      free(E.completion.words[i]);
+    E.completion.count = 0;
+
+    int start = view->cx;
+    while(start > 0 && editorIsWordChar((unsigned char)row->chars[start - 1]))
+      start--;
+    if(start == view->cx) return;
+    if(buf->wordsPending) {
+      for(int i = 0; i < buf->numRows; ++i) {
+        if(editorRowIsPending(&buf->row[i]) && buf->row[i].numWords == 0)
+          editorHighlightColdRow(buf, &buf->row[i]);
+      }
+      buf->wordsPending = 0;
+    }
+    E.completion.count = editorWordComplete(&buf->words,
+        &row->chars[start], view->cx - start, E.completion.words,
+        KILO_COMPLETIONS);
+    if(E.completion.count == 0) {
+      editorSetStatusMessage("No completions");
+      return;
+    }
+    E.completion.buf = buf;
+    E.completion.row = view->cy;
+    E.completion.at = view->cx;
+    E.completion.length = 0;
+    E.completion.choice = -1;
+  }
+
+  int prefix = 0;
+  while(prefix < E.completion.at &&
+      editorIsWordChar((unsigned char)row->chars[E.completion.at - prefix - 1]))
+    prefix++;
+  editorRowDeleteChars(buf, row, E.completion.at, E.completion.length);
+  E.completion.choice = (E.completion.choice + 1) % E.completion.count;
+  char* word = E.completion.words[E.completion.choice];
+  E.completion.length = strlen(word) - prefix;
+  editorRowInsertString(buf, row, E.completion.at, &word[prefix],
+      E.completion.length);
+  view->cx = E.completion.at + E.completion.length;
+
+  /*
+    * Show the words offered from the chosen one on
+  */
+  char list[256];
+  int length = snprintf(list, sizeof(list), "(%d/%d)",
+      E.completion.choice + 1, E.completion.count);
+  for(int i = 0; i < E.completion.count &&
+      length < (int)sizeof(list) - 1; ++i) {
+    char* next = E.completion.words[(E.completion.choice + i) %
+      E.completion.count];
+    length += snprintf(&list[length], sizeof(list) - length,
+        i == 0 ? " [%s]" : " %s", next);
+  }
+  editorSetStatusMessage("%s", list);
+}
+
+/*
+  * Highlight chunk `k` of a long row, or all of a short
+  * row when `k` is -1, and return the highlight of each
+  * byte of its text in a scratch buffer. `*begin` and
+  * `*end` are set to the bytes covered.
+*/
+unsigned char* editorTextHighlight(struct editorBuffer* buf, erow* row,
+    int k, int* begin, int* end) {
+  char* render;
+  unsigned char* highlight;
+  struct highlightState state;
+  int column = 0;
+  if(k == -1) {
+    *begin = 0;
+    *end = row->size;
+    editorScratchRow(buf, row, &render, &highlight, &state);
+  } else {
+    editorChunkValidate(buf, row, k);
+    *begin = row->chunks[k].start;
+    *end = editorChunkEnd(row, k);
+    column = row->chunks[k].rx;
+    int endColumn;
+    editorChunkScan(buf, row, k, 0, &endColumn, &state);
+    editorScratch(0, &render, &highlight);
+  }
+
+  /*
+    * No byte of text comes after its place in the
+    * render, so the highlight is moved down in place
+  */
+  const char* text = editorRowText(row);
+  int r = 0;
+  int i = *begin;
+  while(i < *end) {
+    if(text[i] == '\t') {
+      int spaces = KILO_TAB_STOP - (column % KILO_TAB_STOP);
+      highlight[i - *begin] = highlight[r];
+      r += spaces;
+      column += spaces;
+      i++;
+      continue;
+    }
+    int cp;
+    int length = editorDecodeUTF8(&text[i], *end - i, &cp);
+    for(int j = 0; j < length; ++j)
+      highlight[i - *begin + j] = highlight[r + j];
+    r += length;
+    column += editorCharWidth(cp);
+    i += length;
+  }
+  return highlight;
+}
+
+/*
+  * Follow the brackets of a row from byte `from` on, or
+  * back from just before it when not `forward`, the
+  * depth starting out at `*depth`. Return the byte where
+  * the depth drops below 0, or going back rises above
+  * 0. Else return -1 with `*depth` at the depth at the
+  * far end of the row. Only the chunk of a long row
+  * holding `from` and the one found are highlighted,
+  * the others scanned before are stepped over by their
+  * summaries.
+*/
+int editorBracketWalk(struct editorBuffer* buf, erow* row, int from,
+    int forward, int* depth) {
+  if(forward ? from >= row->size : from <= 0) return -1;
+  int step = forward ? 1 : -1;
+  int k = row->chunks ? editorChunkAt(row, forward ? from : from - 1) : -1;
+  for(int first = 1; ; first = 0, k += step) {
+    if(row->chunks && (k < 0 || k >= row->numChunks)) return -1;
+    /*
+      * A chunk has been scanned, and its summary is
+      * known, once the start of the next one is
+    */
+    if(!first && k < row->validChunks - 1) {
+      struct bracketSummary* summary = &row->chunks[k].brackets;
+      if(forward ? *depth + summary->min >= 0 :
+          *depth + summary->sum - summary->min <= 0) {
+        *depth += summary->sum;
+        continue;
+      }
+    }
+    int begin, end;
+    unsigned char* highlight = editorTextHighlight(buf, row, k, &begin,
+        &end);
+    const char* text = editorRowText(row);
+    if(forward) {
+      for(int i = from > begin ? from : begin; i < end; ++i) {
+        *depth += editorBracketValue(text[i], highlight[i - begin]);
+        if(*depth < 0) return i;
+      }
+    } else {
+      for(int i = (from < end ? from : end) - 1; i >= begin; --i) {
+        *depth += editorBracketValue(text[i], highlight[i - begin]);
+        if(*depth > 0) return i;
+      }
+    }
+    if(row->chunks == NULL) return -1;
+  }
+}
+
+/*
+  * Look for the unmatched bracket after byte `at` of a
+  * row, or before it when not `forward`. The rows in
+  * between are skipped over through the bracket tree,
+  * so only the two rows at the ends are looked at.
+  * Return the row found and set `*offset`, or return -1.
+*/
+int editorBracketSearch(struct editorBuffer* buf, int row, int at,
+    int forward, int* offset) {
+  int depth = 0;
+  int found = editorBracketWalk(buf, &buf->row[row], forward ? at + 1 : at,
+      forward, &depth);
+  if(found != -1) {
+    *offset = found;
+    return row;
+  }
+
+  if(buf->brackets.validRows < buf->numRows ||
+      buf->brackets.rows != buf->numRows)
+    editorBracketBuild(buf);
+  struct bracketTree* tree = &buf->brackets;
+  int target = forward ?
+    editorBracketForward(tree, 1, 0, tree->leaves, row + 1, &depth) :
+    editorBracketBackward(tree, 1, 0, tree->leaves, row, &depth);
+  if(target == -1 || target >= buf->numRows) return -1;
+
+  erow* last = &buf->row[target];
+  found = editorBracketWalk(buf, last, forward ? 0 : last->size, forward,
+      &depth);
+  if(found == -1) return -1;
+  *offset = found;
+  return target;
+}
+
+/*
+  * The bracket under the cursor, else the one just
+  * before it, as a byte of the row. Return -1 when
+  * there is none outside strings and comments.
+*/
+int editorCursorBracket(struct editorView* view, int* forward) {
+  struct editorBuffer* buf = view->buf;
+  if(view->cy >= buf->numRows) return -1;
+  erow* row = &buf->row[view->cy];
+  for(int cx = view->cx; cx >= view->cx - 1 && cx >= 0; --cx) {
+    if(cx >= row->size || !strchr("()[]{}", editorRowText(row)[cx]))
+      continue;
+    int begin, end;
+    unsigned char* highlight = editorTextHighlight(buf, row,
+        row->chunks ? editorChunkAt(row, cx) : -1, &begin, &end);
+    int value = editorBracketValue(editorRowText(row)[cx],
+        highlight[cx - begin]);
+    if(value == 0) continue;
+    *forward = value > 0;
+    return cx;
+  }
+  return -1;
+}
+
+/*
+  * Find the bracket matching the one at the cursor.
+  * Return its row and set `*offset`, or return -1.
+*/
+int editorMatchBracket(struct editorView* view, int* offset) {
+  int forward;
+  int at = editorCursorBracket(view, &forward);
+  if(at == -1) return -1;
+  return editorBracketSearch(view->buf, view->cy, at, forward, offset);
+}
+
+void editorJumpTo(struct editorView* view, int row, int offset) {
+  struct editorBuffer* buf = view->buf;
+  view->cy = row;
+  editorRowThaw(buf, &buf->row[row]);
+  view->cx = offset;
+}
+
+void editorJumpToMatch() {
+  int offset;
+  int row = editorMatchBracket(E.view, &offset);
+  if(row == -1) {
+    editorSetStatusMessage("No matching bracket");
+    return;
+  }
+  editorJumpTo(E.view, row, offset);
+}
+
+/*
+  * Go to the bracket that opens the block the cursor
+  * is in
+*/
+void editorJumpToBlockStart() {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  if(view->cy >= buf->numRows) return;
+  int offset;
+  int found = editorBracketSearch(buf, view->cy, view->cx, 0, &offset);
+  if(found == -1) {
+    editorSetStatusMessage("Not inside a block");
+    return;
+  }
+  editorJumpTo(view, found, offset);
+}
+
+/*
+  * Find the bracket to show as matching the one at the
+  * cursor of the current window
+*/
+void editorUpdateBracketMatch() {
+  E.bracket.buf = NULL;
+  int offset;
+  int row = editorMatchBracket(E.view, &offset);
+  if(row == -1 || E.view->buf->row[row].chunks) return;
+  E.bracket.buf = E.view->buf;
+  E.bracket.row = row;
+  E.bracket.start = editorRenderOffset(editorRowText(&E.view->buf->row[row]),
+      offset, 0);
+}
+
+
+/*
+  * Convert the array of `erow` structs into a single
+  * string that is ready to be written out to a file
+*/
+char *editorRowsToString(struct editorBuffer* buf, int* bufLength) {
+  int totalLength = 0;
+  for(int i = 0; i < buf->numRows; ++i) {
+    totalLength += buf->sizes[i] + 1;
+  }
+  *bufLength = totalLength;
+
+  char *result = malloc(totalLength);
+  char *p = result;
+  int i = 0;
+  while(i < buf->numRows) {
+    if(buf->texts[i] == NULL) {
+      erow* row = &buf->row[i];
+      memcpy(p, editorRowText(row), row->size);
+      p += row->size;
+      *p++ = '\n';
+      i++;
+      continue;
+    }
+    /*
+      * Rows still lying next to each other in a text
+      * block are copied in one go, then their NULs
+      * become newlines
+    */
+    int bytes;
+    int end = editorTextRun(buf, i, &bytes);
+    memcpy(p, buf->texts[i], bytes);
+    for(; i < end; ++i) {
+      p += buf->sizes[i];
+      *p++ = '\n';
+    }
+  }
+  return result;
+}
+
+void editorDiskAdd(struct editorBuffer* buf, uint64_t start, uint64_t end,
+    int rows, uint64_t hash) {
+  if(buf->numDisk == buf->diskCapacity) {
+    buf->diskCapacity = buf->diskCapacity ? buf->diskCapacity * 2 : 64;
+    buf->disk = realloc(buf->disk, sizeof(struct diskBlock) *
+        buf->diskCapacity);
+  }
+  struct diskBlock* block = &buf->disk[buf->numDisk++];
+  block->start = start;
+  block->end = end;
+  block->hash = hash;
+  block->rows = rows;
+}
+
+/*
+  * Remember the size and time of the file just read or
+  * written, when it is a regular file
+*/
+void editorDiskRecord(struct editorBuffer* buf, struct stat* st) {
+  buf->diskKnown = S_ISREG(st->st_mode);
+  buf->diskSize = st->st_size;
+  buf->diskMtime = st->st_mtim;
+}
+
+/*
+  * Big files get a line index on disk, so opening one
+  * again does not split and highlight it from scratch.
+  * The index of a file lives in `$XDG_CACHE_HOME/kilo`
+  * or `~/.cache/kilo`, named after a hash of its path.
+  * It holds the offset, length, bracket summary and
+  * highlight end state of every row, and a hash of the
+  * text of every group of `KILO_COLD_BLOCK_ROWS` rows.
+*/
+#define KILO_INDEX_MIN_SIZE (256 * 1024)
+#define KILO_INDEX_MAGIC 0x31584449304c494bULL
+#define KILO_INDEX_VERSION 3
+
+struct lineIndexHeader {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t pathHash;
+  uint64_t fileSize;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+  char filetype[32];
+  uint32_t numRows;
+  uint32_t numBlocks;
+};
+
+/*
+  * The arrays following the header, in this order
+*/
+struct lineIndex {
+  struct lineIndexHeader* header;
+  uint64_t* hashes;
+  uint32_t* offsets;
+  uint32_t* lengths;
+  int32_t* brackets;
+  unsigned char* states;
+  void* map;
+  size_t mapSize;
+};
+
+uint64_t editorHash64(const char* data, size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ULL ^ length;
+  size_t i = 0;
+  for(; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, &data[i], sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ULL;
+    hash ^= hash >> 29;
+  }
+  for(; i < length; ++i)
+    hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+/*
+  * Hash the lines of a group of a file between `start`
+  * and `end` the way its rows hold them: without the
+  * carriage returns at their ends and each followed by
+  * a newline, so the hash is the one `editorRowsHash`
+  * gives those rows
+*/
+uint64_t editorHashGroup(const char* data, size_t start, size_t end) {
+  size_t length = end - start;
+  if(length > 0 && data[end - 1] == '\n' &&
+      memchr(&data[start], '\r', length) == NULL)
+    return editorHash64(&data[start], length);
+
+  char* text = malloc(length + 1);
+  size_t n = 0;
+  size_t position = start;
+  while(position < end) {
+    const char* line = &data[position];
+    const char* newline = memchr(line, '\n', end - position);
+    size_t lineLength = newline ? (size_t)(newline - line) : end - position;
+    position += newline ? lineLength + 1 : lineLength;
+    while(lineLength > 0 && line[lineLength - 1] == '\r') lineLength--;
+    memcpy(&text[n], line, lineLength);
+    n += lineLength;
+    text[n++] = '\n';
+  }
+  uint64_t hash = editorHash64(text, n);
+  free(text);
+  return hash;
+}
+
+/*
+  * Find where the index of `filename` lives, creating
+  * the directory on the way. Return -1 when there is
+  * nowhere to put it.
+*/
+int editorIndexPath(const char* filename, char* path, size_t size,
+    uint64_t* pathHash) {
+  char resolved[PATH_MAX];
+  if(realpath(filename, resolved) == NULL) return -1;
+  *pathHash = editorHash64(resolved, strlen(resolved));
+
+  char dir[PATH_MAX];
+  const char* cache = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if(cache && cache[0]) {
+    snprintf(dir, sizeof(dir), "%s", cache);
+  } else if(home && home[0]) {
+    snprintf(dir, sizeof(dir), "%s/.cache", home);
+    mkdir(dir, 0700);
+  } else {
+    return -1;
+  }
+  size_t length = strlen(dir);
+  snprintf(dir + length, sizeof(dir) - length, "/kilo");
+  if(mkdir(dir, 0700) == -1 && errno != EEXIST) return -1;
+  snprintf(path, size, "%s/%016llx.idx", dir, (unsigned long long)*pathHash);
+  return 0;
+}
+
+size_t editorIndexSize(uint32_t numRows, uint32_t numBlocks) {
+  return sizeof(struct lineIndexHeader) + sizeof(uint64_t) * numBlocks +
+    (sizeof(uint32_t) * 4 + 1) * (size_t)numRows;
+}
+
+void editorIndexArrays(struct lineIndex* index, char* base) {
+  index->header = (struct lineIndexHeader*)base;
+  index->hashes = (uint64_t*)(base + sizeof(struct lineIndexHeader));
+  index->offsets = (uint32_t*)(index->hashes + index->header->numBlocks);
+  index->lengths = index->offsets + index->header->numRows;
+  index->brackets = (int32_t*)(index->lengths + index->header->numRows);
+  index->states = (unsigned char*)(index->brackets +
+      2 * index->header->numRows);
+}
+
+/*
+  * Map the index of a buffer's file, if there is one
+  * made for the same path and syntax
+*/
+int editorIndexLoad(struct editorBuffer* buf, struct lineIndex* index) {
+  char path[PATH_MAX];
+  uint64_t pathHash;
+  if(editorIndexPath(buf->filename, path, sizeof(path), &pathHash) == -1)
+    return -1;
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) return -1;
+  struct stat st;
+  if(fstat(fd, &st) == -1 ||
+      (size_t)st.st_size < sizeof(struct lineIndexHeader)) {
+    close(fd);
+    return -1;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) return -1;
+
+  struct lineIndexHeader* header = map;
+  const char* filetype = buf->syntax ? buf->syntax->filetype : "";
+  if(header->magic != KILO_INDEX_MAGIC ||
+      header->version != KILO_INDEX_VERSION ||
+      header->pathHash != pathHash ||
+      strncmp(header->filetype, filetype, sizeof(header->filetype)) ||
+      header->numBlocks != (header->numRows + KILO_COLD_BLOCK_ROWS - 1) /
+        KILO_COLD_BLOCK_ROWS ||
+      editorIndexSize(header->numRows, header->numBlocks) !=
+        (size_t)st.st_size) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+  index->map = map;
+  index->mapSize = st.st_size;
+  editorIndexArrays(index, map);
+  return 0;
+}
+
+/*
+  * Write the index of a buffer just read from a file of
+  * `st.st_size` bytes. The file is written under another
+  * name first, so a reader never sees half of it.
+*/
+void editorIndexSave(struct editorBuffer* buf, struct stat* st,
+    uint32_t* offsets, uint64_t* hashes) {
+  char path[PATH_MAX];
+  char temporary[PATH_MAX + 16];
+  uint64_t pathHash;
+  if(editorIndexPath(buf->filename, path, sizeof(path), &pathHash) == -1)
+    return;
+
+  uint32_t numRows = buf->numRows;
+  uint32_t numBlocks = (numRows + KILO_COLD_BLOCK_ROWS - 1) /
+    KILO_COLD_BLOCK_ROWS;
+  size_t size = editorIndexSize(numRows, numBlocks);
+  char* data = calloc(1, size);
+  if(data == NULL) return;
+
+  struct lineIndex index;
+  struct lineIndexHeader* header = (struct lineIndexHeader*)data;
+  header->magic = KILO_INDEX_MAGIC;
+  header->version = KILO_INDEX_VERSION;
+  header->pathHash = pathHash;
+  header->fileSize = st->st_size;
+  header->mtimeSec = st->st_mtim.tv_sec;
+  header->mtimeNsec = st->st_mtim.tv_nsec;
+  if(buf->syntax)
+    strncpy(header->filetype, buf->syntax->filetype,
+        sizeof(header->filetype) - 1);
+  header->numRows = numRows;
+  header->numBlocks = numBlocks;
+  editorIndexArrays(&index, data);
+  memcpy(index.hashes, hashes, sizeof(uint64_t) * numBlocks);
+  memcpy(index.offsets, offsets, sizeof(uint32_t) * numRows);
+  for(uint32_t i = 0; i < numRows; ++i) {
+    index.lengths[i] = buf->row[i].size;
+    index.brackets[2 * i] = buf->row[i].brackets.sum;
+    index.brackets[2 * i + 1] = buf->row[i].brackets.min;
+    index.states[i] = buf->row[i].hlOpenComment;
+  }
+
+  snprintf(temporary, sizeof(temporary), "%s.%d", path, (int)getpid());
+  int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if(fd != -1) {
+    int ok = write(fd, data, size) == (ssize_t)size;
+    close(fd);
+    if(!ok || rename(temporary, path) == -1) unlink(temporary);
+  }
+  free(data);
+}
+
+/*
+  * Copy `count` lines of `data` into a text block
+*/
+struct textBlock* editorMakeTextBlock(const char* data,
+    const size_t* offsets, const int* lengths, int count) {
+  struct textBlock* block = malloc(sizeof(struct textBlock));
+  block->size = 0;
+  for(int k = 0; k < count; ++k) block->size += lengths[k] + 1;
+  block->data = malloc(block->size ? block->size : 1);
+  char* p = block->data;
+  for(int k = 0; k < count; ++k) {
+    memcpy(p, &data[offsets[k]], lengths[k]);
+    p += lengths[k];
+    *p++ = '\0';
+  }
+  return block;
+}
+
+/*
+  * Find up to `KILO_COLD_BLOCK_ROWS` lines of `data`
+  * from `*position` on and drop their line endings.
+  * Return how many were found.
+*/
+int editorSplitLines(const char* data, size_t size, size_t* position,
+    size_t* offsets, int* lengths) {
+  int count = 0;
+  while(*position < size && count < KILO_COLD_BLOCK_ROWS) {
+    const char* line = &data[*position];
+    const char* newline = memchr(line, '\n', size - *position);
+    size_t length = newline ? (size_t)(newline - line) : size - *position;
+    *position += newline ? length + 1 : length;
+    while(length > 0 && line[length - 1] == '\r') length--;
+    offsets[count] = line - data;
+    lengths[count++] = length;
+  }
+  return count;
+}
+
+/*
+  * Read a file mapped in memory. Groups of rows at the
+  * start of the file which hash the same as in its index
+  * are taken from the index as they are: their lines are
+  * not looked for and they are only rendered and
+  * highlighted once they are looked at. When the file is
+  * as big and as old as when the index was written, not
+  * even the hashes are checked. The rest of the file is
+  * split and highlighted as usual, then the index is
+  * written again.
+*/
+void editorLoadMapped(struct editorBuffer* buf, const char* data,
+    size_t size, struct stat* st) {
+  int useIndex = size >= KILO_INDEX_MIN_SIZE && size <= UINT32_MAX;
+  struct lineIndex index;
+  int haveIndex = useIndex && editorIndexLoad(buf, &index) == 0;
+  int unchanged = haveIndex && index.header->fileSize == size &&
+    index.header->mtimeSec == st->st_mtim.tv_sec &&
+    index.header->mtimeNsec == st->st_mtim.tv_nsec;
+
+  uint32_t* offsets = NULL;
+  uint64_t* hashes = NULL;
+  int numBlocks = 0;
+  int blockCapacity = 0;
+  size_t lineOffsets[KILO_COLD_BLOCK_ROWS];
+  int lengths[KILO_COLD_BLOCK_ROWS];
+  size_t position = 0;
+  int reused = 0;
+
+  while(position < size) {
+    int first = buf->numRows;
+    int count = 0;
+    uint64_t hash = 0;
+    int fromIndex = 0;
+    if(numBlocks == blockCapacity) {
+      blockCapacity = blockCapacity ? blockCapacity * 2 : 256;
+      hashes = realloc(hashes, sizeof(uint64_t) * blockCapacity);
+      offsets = realloc(offsets, sizeof(uint32_t) * blockCapacity *
+          KILO_COLD_BLOCK_ROWS);
+    }
+
+    if(haveIndex && reused == first &&
+        (uint32_t)numBlocks < index.header->numBlocks) {
+      uint32_t at = numBlocks * KILO_COLD_BLOCK_ROWS;
+      count = index.header->numRows - at;
+      if(count > KILO_COLD_BLOCK_ROWS) count = KILO_COLD_BLOCK_ROWS;
+      size_t end = at + count < index.header->numRows ?
+        index.offsets[at + count] : index.header->fileSize;
+      /*
+        * The group has to end where a line of the file
+        * does, or its last row would be cut short
+      */
+      if(index.offsets[at] == position && end <= size && end > position &&
+          (end == size || data[end - 1] == '\n')) {
+        hash = unchanged ? index.hashes[numBlocks] :
+          editorHashGroup(data, position, end);
+        fromIndex = (hash == index.hashes[numBlocks]);
+      }
+      for(int k = 0; fromIndex && k < count; ++k) {
+        if(index.offsets[at + k] + (size_t)index.lengths[at + k] > end)
+          fromIndex = 0;
+      }
+      if(fromIndex) {
+        for(int k = 0; k < count; ++k) {
+          lengths[k] = index.lengths[at + k];
+          lineOffsets[k] = offsets[first + k] = index.offsets[at + k];
+        }
+        struct textBlock* block = editorMakeTextBlock(data, lineOffsets,
+            lengths, count);
+        editorAppendBlockRows(buf, block, lengths, count,
+            &index.states[at], &index.brackets[2 * at]);
+        editorDiskAdd(buf, position, end, count, hash);
+        buf->wordsPending = 1;
+        reused += count;
+        position = end;
+      }
+    }
+
+    if(!fromIndex) {
+      size_t start = position;
+      count = editorSplitLines(data, size, &position, lineOffsets, lengths);
+      for(int k = 0; k < count; ++k) offsets[first + k] = lineOffsets[k];
+      struct textBlock* block = editorMakeTextBlock(data, lineOffsets,
+          lengths, count);
+      editorAppendBlockRows(buf, block, lengths, count, NULL, NULL);
+      hash = editorHashGroup(data, start, position);
+      editorDiskAdd(buf, start, position, count, hash);
+    }
+    hashes[numBlocks++] = hash;
+  }
+
+  if(useIndex && !(unchanged && reused == buf->numRows))
+    editorIndexSave(buf, st, offsets, hashes);
+  if(haveIndex) munmap(index.map, index.mapSize);
+  free(offsets);
+  free(hashes);
+}
+
+/*
+  * Read what can't be mapped, like pipes, line by line
+*/
+void editorLoadStream(struct editorBuffer* buf, FILE* fp) {
+  char* line = NULL;
+  size_t lineCap = 0;
+  ssize_t lineLength = -1;
+
+  /*
+    * Lines are gathered into text blocks of
+    * `KILO_COLD_BLOCK_ROWS` rows
+  */
+  int lengths[KILO_COLD_BLOCK_ROWS];
+  int count = 0;
+  char* data = NULL;
+  int size = 0;
+  int capacity = 0;
+
+  while((lineLength = getline(&line, &lineCap, fp)) != -1) {
+    while(lineLength > 0 && (line[lineLength - 1]
+      == '\n' || line[lineLength - 1] == '\r'))
+      lineLength--;
+    if(size + lineLength + 1 > capacity) {
+      capacity = capacity * 2 > size + lineLength + 1 ?
+        capacity * 2 : size + lineLength + 1;
+      data = realloc(data, capacity);
+    }
+    memcpy(&data[size], line, lineLength);
+    data[size + lineLength] = '\0';
+    size += lineLength + 1;
+    lengths[count++] = lineLength;
+
+    if(count == KILO_COLD_BLOCK_ROWS) {
+      struct textBlock* block = malloc(sizeof(struct textBlock));
+      block->data = realloc(data, size);
+      block->size = size;
+      editorAppendBlockRows(buf, block, lengths, count, NULL, NULL);
+      data = NULL;
+      size = capacity = count = 0;
+    }
+  }
+  if(count) {
+    struct textBlock* block = malloc(sizeof(struct textBlock));
+    block->data = realloc(data, size);
+    block->size = size;
+    editorAppendBlockRows(buf, block, lengths, count, NULL, NULL);
+  }
+  free(line);
+}
+
+/*
+  * Open the file and write the content to
+  * `buf->row.chars`. Return -1 and leave `errno`
+  * set when the file can't be read.
+*/
+int editorOpen(struct editorBuffer* buf, char* filename) {
+  free(buf->filename);
+  buf->filename = strdup(filename);
+
+  editorSelectSyntaxHighlight(buf);
+
+  FILE *fp = fopen(filename, "r");
+  if(!fp) return -1;
+
+  struct stat st;
+  void* map = MAP_FAILED;
+  buf->numDisk = 0;
+  buf->diskKnown = 0;
+  if(fstat(fileno(fp), &st) == 0) {
+    editorDiskRecord(buf, &st);
+    if(S_ISREG(st.st_mode) && st.st_size > 0)
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+  }
+  if(map != MAP_FAILED) {
+    editorLoadMapped(buf, map, st.st_size, &st);
+    munmap(map, st.st_size);
+  } else {
+    if(st.st_size > 0) buf->diskKnown = 0;
+    editorLoadStream(buf, fp);
+  }
+  fclose(fp);
+  buf->dirty = 0;
+  editorMarkSaved(buf);
+  return 0;
+}
+
+/*
+  * Input piped in with `kilo -`. The pipe is read from
+  * the main loop without blocking, and the lines it
+  * completes are added to `buf` a batch at a time, while
+  * keys are read from the terminal. `data` holds what
+  * came after the last full line.
+*/
+struct streamInput {
+  int fd;
+  struct editorBuffer* buf;
+  char* data;
+  size_t size;
+  size_t capacity;
+  size_t bytes;
+};
+
+static struct streamInput stream = {-1, NULL, NULL, 0, 0, 0};
+
+/*
+  * Keep standard input for reading the pipe and take
+  * keys from the terminal instead. Called before raw
+  * mode is set up, since that works on standard input.
+*/
+int editorOpenStream() {
+  if(isatty(STDIN_FILENO)) {
+    errno = EINVAL;
+    return -1;
+  }
+  stream.fd = dup(STDIN_FILENO);
+  int tty = open("/dev/tty", O_RDWR);
+  if(stream.fd == -1 || tty == -1) return -1;
+  if(dup2(tty, STDIN_FILENO) == -1) return -1;
+  close(tty);
+  fcntl(stream.fd, F_SETFL, fcntl(stream.fd, F_GETFL) | O_NONBLOCK);
+  return 0;
+}
+
+void editorCloseStream() {
+  close(stream.fd);
+  free(stream.data);
+  stream.fd = -1;
+  stream.buf = NULL;
+  stream.data = NULL;
+  stream.size = stream.capacity = 0;
+}
+
+/*
+  * Add the lines of `data` to the buffer of the stream.
+  * Without syntax highlighting every row ends in the
+  * plain state, so the rows are added like the ones of a
+  * line index: only rendered and highlighted once they
+  * are looked at.
+*/
+void editorStreamLines(const char* data, size_t size) {
+  struct editorBuffer* buf = stream.buf;
+  size_t offsets[KILO_COLD_BLOCK_ROWS];
+  int lengths[KILO_COLD_BLOCK_ROWS];
+  unsigned char states[KILO_COLD_BLOCK_ROWS];
+  int32_t brackets[2 * KILO_COLD_BLOCK_ROWS];
+  size_t position = 0;
+  while(position < size) {
+    int count = editorSplitLines(data, size, &position, offsets, lengths);
+    struct textBlock* block = editorMakeTextBlock(data, offsets, lengths,
+        count);
+    if(buf->syntax) {
+      editorAppendBlockRows(buf, block, lengths, count, NULL, NULL);
+      continue;
+    }
+    for(int k = 0; k < count; ++k) {
+      struct bracketSummary summary;
+      editorBracketScan(&data[offsets[k]], NULL, lengths[k], &summary);
+      states[k] = 0;
+      brackets[2 * k] = summary.sum;
+      brackets[2 * k + 1] = summary.min;
+    }
+    editorAppendBlockRows(buf, block, lengths, count, states, brackets);
+    buf->wordsPending = 1;
+  }
+}
+
+/*
+  * Read what the pipe holds, up to `KILO_STREAM_BATCH`
+  * bytes, and add the lines it completes. Return 1 when
+  * the screen needs drawing.
+*/
+int editorReadStream() {
+  if(stream.fd == -1) return 0;
+  size_t start = stream.size;
+  int ended = 0;
+  while(stream.size - start < KILO_STREAM_BATCH) {
+    if(stream.capacity - stream.size < 64 * 1024) {
+      stream.capacity = stream.capacity * 2 > stream.size + 64 * 1024 ?
+        stream.capacity * 2 : stream.size + 64 * 1024;
+      stream.data = realloc(stream.data, stream.capacity);
+    }
+    ssize_t nread = read(stream.fd, &stream.data[stream.size],
+        stream.capacity - stream.size);
+    if(nread == -1 && errno == EINTR) continue;
+    if(nread == -1 && errno == EAGAIN) break;
+    if(nread <= 0) {
+      ended = 1;
+      break;
+    }
+    stream.size += nread;
+    stream.bytes += nread;
+  }
+  if(stream.size == start && !ended) return 0;
+
+  size_t end = stream.size;
+  if(!ended) {
+    const char* newline = memrchr(&stream.data[start], '\n',
+        stream.size - start);
+    end = newline ? (size_t)(newline - stream.data) + 1 : 0;
+  }
+  editorStreamLines(stream.data, end);
+  memmove(stream.data, &stream.data[end], stream.size - end);
+  stream.size -= end;
+
+  if(ended) {
+    char size[16];
+    editorSetStatusMessage("Read %sB from standard input",
+        editorFormatSize(stream.bytes, size, sizeof(size)));
+    editorCloseStream();
+  }
+  return 1;
+}
+
+/*
+  * Wait for keys, or for the pipe of `kilo -` to have
+  * something to read. Return 1 when keys are waiting.
+*/
+int editorWaitForInput(int timeout) {
+  if(stream.fd == -1) return editorInputPending(timeout);
+  if(editorInputPending(0)) return 1;
+  struct pollfd fds[2] = {
+    {STDIN_FILENO, POLLIN, 0},
+    {stream.fd, POLLIN, 0}
+  };
+  if(poll(fds, 2, timeout) <= 0) return 0;
+  return (fds[0].revents & POLLIN) != 0;
+}
+
+/*
+  * Whether the file of a buffer is no longer the one it
+  * was last read from or written to. Costs a `stat`.
+*/
+int editorDiskChanged(struct editorBuffer* buf, struct stat* st) {
+  if(!buf->diskKnown || buf->filename == NULL) return 0;
+  if(stat(buf->filename, st) == -1) return 0;
+  return st->st_size != buf->diskSize ||
+    st->st_mtim.tv_sec != buf->diskMtime.tv_sec ||
+    st->st_mtim.tv_nsec != buf->diskMtime.tv_nsec;
+}
+
+/*
+  * Hash the groups of rows just written as `content`
+*/
+void editorDiskFromText(struct editorBuffer* buf, const char* content) {
+  buf->numDisk = 0;
+  uint64_t start = 0;
+  for(int first = 0; first < buf->numRows; first += KILO_COLD_BLOCK_ROWS) {
+    int count = buf->numRows - first;
+    if(count > KILO_COLD_BLOCK_ROWS) count = KILO_COLD_BLOCK_ROWS;
+    uint64_t end = start;
+    for(int i = first; i < first + count; ++i) end += buf->sizes[i] + 1;
+    editorDiskAdd(buf, start, end, count,
+        editorHashGroup(content, start, end));
+    start = end;
+  }
+}
+
+/*
+  * Count the groups at the start and at the end of the
+  * file as last read that `data` still holds, hashing
+  * from both ends until a group differs. Groups at the
+  * end are looked for where the change in size moved
+  * them to.
+*/
+void editorDiskMatch(struct editorBuffer* buf, const char* data, size_t size,
+    int* head, int* tail) {
+  int h = 0;
+  while(h < buf->numDisk) {
+    struct diskBlock* block = &buf->disk[h];
+    if(block->end > size ||
+        (block->end < size && data[block->end - 1] != '\n'))
+      break;
+    if(editorHashGroup(data, block->start, block->end) != block->hash)
+      break;
+    h++;
+  }
+
+  int64_t shift = (int64_t)size - (int64_t)buf->diskSize;
+  int64_t limit = h ? (int64_t)buf->disk[h - 1].end : 0;
+  int t = 0;
+  while(t < buf->numDisk - h) {
+    struct diskBlock* block = &buf->disk[buf->numDisk - 1 - t];
+    int64_t start = block->start + shift;
+    if(start < limit || (start > 0 && data[start - 1] != '\n')) break;
+    if(editorHashGroup(data, start, start + block->end - block->start) !=
+        block->hash)
+      break;
+    t++;
+  }
+  *head = h;
+  *tail = t;
+}
+
+void editorSave(struct editorBuffer* buf) {
+  if(buf->filename == NULL) {
+    buf->filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+    if(buf->filename == NULL) {
+      editorSetStatusMessage("Save aborted");
+      return;
+    }
+    editorSelectSyntaxHighlight(buf);
+  }
+  struct stat st;
+  int changed = editorDiskChanged(buf, &st);
+  if(changed &&
+      editorAsk("File changed on disk since it was read. Overwrite it? (y/n)",
+        "yn") != 'y') {
+    editorSetStatusMessage("Save aborted");
+    return;
+  }
+  /*
+    * A file still the way it was read or saved last is
+    * not written again when no row changed, or when the
+    * rows hash the same as its groups
+  */
+  int same = !changed && buf->diskKnown && access(buf->filename, F_OK) == 0;
+  if(same && !editorBufferModified(buf)) {
+    editorSetStatusMessage("No changes to save");
+    return;
+  }
+  int length;
+
+  char *content = editorRowsToString(buf, &length);
+  if(same && (off_t)length == buf->diskSize) {
+    int head, tail;
+    editorDiskMatch(buf, content, length, &head, &tail);
+    if(head == buf->numDisk) {
+      free(content);
+      buf->dirty = 0;
+      editorMarkSaved(buf);
+      editorSetStatusMessage("No changes to save");
+      return;
+    }
+  }
+
+  int fd = open(buf->filename, O_RDWR | O_CREAT, 0644);
+  if(fd != -1) {
+    if(ftruncate(fd, length) != -1) {
+      if(write(fd, content, length) == length) {
+        editorDiskFromText(buf, content);
+        if(fstat(fd, &st) == 0) editorDiskRecord(buf, &st);
+        close(fd);
+        free(content);
+        buf->dirty = 0;
+        editorMarkSaved(buf);
+        editorSetStatusMessage("%d bytes written to disk", length);
+        return;
+      }
+    }
+    close(fd);
+  }
+  free(content);
+  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+
+/*
+  * Hash `count` rows from `first` on the way they would
+  * be written. Return 0 when the buffer has fewer rows.
+*/
+int editorRowsHash(struct editorBuffer* buf, int first, int count,
+    uint64_t* hash, char** text, size_t* capacity) {
+  if(first < 0 || first + count > buf->numRows) return 0;
+  size_t length = 0;
+  for(int i = first; i < first + count; ++i) length += buf->sizes[i] + 1;
+  if(length > *capacity) {
+    *capacity = length;
+    *text = realloc(*text, length);
+  }
+  char* p = *text;
+  for(int i = first; i < first + count; ++i) {
+    memcpy(p, editorRowText(&buf->row[i]), buf->sizes[i]);
+    p += buf->sizes[i];
+    *p++ = '\n';
+  }
+  *hash = editorHash64(*text, length);
+  return 1;
+}
+
+/*
+  * Count the groups at each end of the file as last read
+  * that a buffer with changes of its own still holds.
+  * Return the rows they make up.
+*/
+void editorBufferMatch(struct editorBuffer* buf, int* headRows,
+    int* tailRows) {
+  char* text = NULL;
+  size_t capacity = 0;
+  uint64_t hash;
+  int h = 0;
+  int row = 0;
+  while(h < buf->numDisk &&
+      editorRowsHash(buf, row, buf->disk[h].rows, &hash, &text, &capacity) &&
+      hash == buf->disk[h].hash)
+    row += buf->disk[h++].rows;
+  *headRows = row;
+
+  *tailRows = 0;
+  row = buf->numRows;
+  for(int t = buf->numDisk - 1; t >= h; --t) {
+    row -= buf->disk[t].rows;
+    if(row < *headRows ||
+        !editorRowsHash(buf, row, buf->disk[t].rows, &hash, &text,
+          &capacity) ||
+        hash != buf->disk[t].hash)
+      break;
+    *tailRows += buf->disk[t].rows;
+  }
+  free(text);
+}
+
+/*
+  * Replace the rows `at..at+count-1` with the lines of
+  * `data` between `start` and `end`, and record them as
+  * new groups of the file. Only the new rows are
+  * rendered and highlighted, along with the rows below
+  * whose state changes. Return how many there are.
+*/
+int editorSpliceLines(struct editorBuffer* buf, int at, int count,
+    const char* data, size_t start, size_t end) {
+  int lines = 0;
+  for(const char* p = &data[start]; p < &data[end]; ++lines) {
+    const char* newline = memchr(p, '\n', &data[end] - p);
+    p = newline ? newline + 1 : &data[end];
+  }
+
+  for(int i = at; i < at + count; ++i) editorFreeRow(buf, &buf->row[i]);
+  if(lines > count) editorGrowRows(buf, lines - count);
+  int tail = buf->numRows - at - count;
+  memmove(&buf->row[at + lines], &buf->row[at + count], sizeof(erow) * tail);
+  memmove(&buf->sizes[at + lines], &buf->sizes[at + count],
+      sizeof(int) * tail);
+  memmove(&buf->texts[at + lines], &buf->texts[at + count],
+      sizeof(char*) * tail);
+  buf->numRows += lines - count;
+  editorRowsMoved(buf, at);
+  for(int j = at + lines; j < buf->numRows; ++j) buf->row[j].idx = j;
+
+  size_t position = start;
+  int row = at;
+  while(position < end) {
+    size_t offsets[KILO_COLD_BLOCK_ROWS];
+    int lengths[KILO_COLD_BLOCK_ROWS];
+    size_t first = position;
+    int n = editorSplitLines(data, end, &position, offsets, lengths);
+    editorPlaceBlockRows(buf, row,
+        editorMakeTextBlock(data, offsets, lengths, n), lengths, n, NULL,
+        NULL);
+    editorDiskAdd(buf, first, position, n,
+        editorHashGroup(data, first, position));
+    row += n;
+  }
+  if(row < buf->numRows) editorUpdateSyntax(buf, &buf->row[row]);
+  return lines;
+}
+
+/*
+  * Take in the part of a file that changed on disk,
+  * between the `head` groups at its start and the
+  * `tail` groups at its end, as the rows from `at` on
+*/
+int editorReloadRegion(struct editorBuffer* buf, const char* data,
+    size_t size, int head, int tail, int at) {
+  struct diskBlock* old = buf->disk;
+  int numOld = buf->numDisk;
+  int64_t shift = (int64_t)size - (int64_t)buf->diskSize;
+  int count = 0;
+  for(int b = head; b < numOld - tail; ++b) count += old[b].rows;
+  size_t start = head ? old[head - 1].end : 0;
+  size_t end = tail ? old[numOld - tail].start + shift : size;
+
+  buf->disk = NULL;
+  buf->numDisk = 0;
+  buf->diskCapacity = 0;
+  for(int b = 0; b < head; ++b)
+    editorDiskAdd(buf, old[b].start, old[b].end, old[b].rows, old[b].hash);
+  int lines = editorSpliceLines(buf, at, count, data, start, end);
+  for(int b = numOld - tail; b < numOld; ++b)
+    editorDiskAdd(buf, old[b].start + shift, old[b].end + shift, old[b].rows,
+        old[b].hash);
+  free(old);
+
+  if(E.match.buf == buf) E.match.buf = NULL;
+  for(int i = 0; i < E.numViews; ++i) {
+    struct editorView* view = E.views[i];
+    if(view->buf != buf) continue;
+    if(view->cy >= at + count) view->cy += lines - count;
+    else if(view->cy >= at + lines) view->cy = at + lines;
+    if(view->cy > buf->numRows) view->cy = buf->numRows;
+    if(view->cy < buf->numRows) {
+      if(view->cx > buf->row[view->cy].size)
+        view->cx = buf->row[view->cy].size;
+    } else {
+      view->cx = 0;
+    }
+  }
+  return lines;
+}
+
+/*
+  * Read a changed file again from scratch, dropping the
+  * changes of the buffer
+*/
+void editorReloadBuffer(struct editorBuffer* buf) {
+  for(int i = 0; i < buf->numRows; ++i) editorFreeRow(buf, &buf->row[i]);
+  buf->numRows = 0;
+  editorRowsMoved(buf, 0);
+  if(E.match.buf == buf) E.match.buf = NULL;
+  char* filename = strdup(buf->filename);
+  if(editorOpen(buf, filename) == -1)
+    editorSetStatusMessage("Can't read %s: %s", filename, strerror(errno));
+  free(filename);
+  for(int i = 0; i < E.numViews; ++i) {
+    struct editorView* view = E.views[i];
+    if(view->buf != buf) continue;
+    if(view->cy > buf->numRows) view->cy = buf->numRows;
+    view->cx = 0;
+  }
+}
+
+/*
+  * Take in what another program changed in the file of
+  * a buffer. A buffer without changes of its own gets
+  * the changed rows right away. Otherwise the user
+  * picks between reading the file again, merging the
+  * changed rows in when they are apart from the
+  * buffer's own changes, and keeping the buffer as it
+  * is. Return 1 when anything was done.
+*/
+int editorCheckBuffer(struct editorBuffer* buf) {
+  struct stat st;
+  if(!editorDiskChanged(buf, &st)) return 0;
+  int fd = open(buf->filename, O_RDONLY);
+  if(fd == -1) return 0;
+  if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return 0;
+  }
+  void* map = NULL;
+  if(st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+      close(fd);
+      return 0;
+    }
+  }
+  close(fd);
+  const char* data = map ? map : "";
+
+  int head, tail;
+  editorDiskMatch(buf, data, st.st_size, &head, &tail);
+  int oldRows = 0;
+  int headRows = 0;
+  int tailRows = 0;
+  for(int b = 0; b < buf->numDisk; ++b) {
+    oldRows += buf->disk[b].rows;
+    if(b < head) headRows += buf->disk[b].rows;
+    if(b >= buf->numDisk - tail) tailRows += buf->disk[b].rows;
+  }
+  int at = headRows;
+
+  if(editorBufferModified(buf)) {
+    char question[256];
+    snprintf(question, sizeof(question),
+        "%.80s changed on disk: (r)eload it, (m)erge into yours, "
+        "(k)eep yours", buf->filename);
+    int answer = editorAsk(question, "rmk");
+    if(answer == 'm') {
+      int ownHead, ownTail;
+      editorBufferMatch(buf, &ownHead, &ownTail);
+      if(oldRows - tailRows <= ownHead) {
+        at = headRows;
+      } else if(headRows >= oldRows - ownTail) {
+        at = headRows + buf->numRows - oldRows;
+      } else {
+        answer = 'o';
+      }
+    }
+    if(answer == 'r') {
+      if(map) munmap(map, st.st_size);
+      editorReloadBuffer(buf);
+      return 1;
+    }
+    if(answer != 'm') {
+      if(map) munmap(map, st.st_size);
+      editorDiskRecord(buf, &st);
+      editorSetStatusMessage(answer == 'o' ?
+          "Changes on disk overlap yours, kept yours" :
+          "Kept yours, saving will overwrite the file");
+      return 1;
+    }
+  }
+
+  int count = oldRows - headRows - tailRows;
+  int lines = editorReloadRegion(buf, data, st.st_size, head, tail, at);
+  buf->stats.savedRows += lines - count;
+  editorDiskRecord(buf, &st);
+  if(map) munmap(map, st.st_size);
+  editorSetStatusMessage("%.40s changed on disk, %d rows read again "
+      "in place of %d", buf->filename, lines, count);
+  return 1;
+}
+
+void editorFindCallback(char* query, int key) {
+  static int lastMatch = -1;
+  static int direction = 1;
+
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+
+  E.match.buf = NULL;
+  editorInvalidate(DIRTY_TEXT | DIRTY_STATUS);
+
+  if(key == '\r' || key == '\x1b') {
+    lastMatch = -1;
+    direction = 1;
+    return;
+  } else if(key == ARROW_RIGHT || key == ARROW_DOWN) {
+    direction = 1;
+  } else if (key == ARROW_LEFT || key == ARROW_UP) {
+    direction = -1;
+  } else {
+    lastMatch = -1;
+    direction = 1;
+  }
+  if(lastMatch == -1) direction = 1;
+  int current = lastMatch;
+
+  for(int i = 0; i < buf->numRows; ++i) {
+    current += direction;
+    if(current == -1) current = buf->numRows - 1;
+    else if(current == buf->numRows) current = 0;
+    erow* row = &buf->row[current];
+    if(row->cold || editorRowIsPending(row)) {
+      /*
+        * Look at the unrendered text first and only thaw
+        * rows that may match. Tabs render as spaces, so a
+        * query with spaces may also match where tabs are.
+      */
+      const char* text = editorRowText(row);
+      if(!memmem(text, row->size, query, strlen(query)) &&
+          !(strchr(query, ' ') && memchr(text, '\t', row->size)))
+        continue;
+      editorRowThaw(buf, row);
+    }
+    if(row->chunks) {
+      int queryLength = strlen(query);
+      char* match = memmem(row->chars, row->size, query, queryLength);
+      if(match == NULL) continue;
+      lastMatch = current;
+      view->cy = current;
+      view->cx = match - row->chars;
+      view->rowOff = buf->numRows;
+
+      int k = editorChunkAt(row, view->cx);
+      editorChunkValidate(buf, row, k);
+      struct rowChunk* chunk = &row->chunks[k];
+      E.match.buf = buf;
+      E.match.row = current;
+      E.match.chunk = k;
+      E.match.start = editorRenderOffset(&row->chars[chunk->start],
+          view->cx - chunk->start, chunk->rx);
+      E.match.length = queryLength;
+      break;
+    }
+    char* match = strstr(row->render, query);
+    if(match) {
+      lastMatch = current;
+      view->cy = current;
+      view->cx = editorRowRenderToCx(buf, row, match - row->render);
+      view->rowOff = buf->numRows;
+
+      E.match.buf = buf;
+      E.match.row = current;
+      E.match.chunk = -1;
+      E.match.start = match - row->render;
+      E.match.length = strlen(query);
+      break;
+    }
+  }
+}
+
+void editorFind() {
+  struct editorView* view = E.view;
+  int savedCx = view->cx;
+  int savedCy = view->cy;
+  int savedColOff = view->colOff;
+  int savedRowOff = view->rowOff;
+  int savedLineOff = view->lineOff;
+
+  char* query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+
+  if(query) {
+    free(query);
+  } else {
+    view->cx = savedCx;
+    view->cy = savedCy;
+    view->colOff = savedColOff;
+    view->rowOff = savedRowOff;
+    view->lineOff = savedLineOff;
+  }
+}
+
+/*
+  * Number of threads worth starting for `count` items
+  * when each thread should get at least `minimum` of them
+*/
+int editorWorkerCount(int count, int minimum) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int workers = count / minimum;
+  if(workers > cpus) workers = cpus;
+  if(workers > KILO_MAX_WORKERS) workers = KILO_MAX_WORKERS;
+  if(workers < 1) workers = 1;
+  return workers;
+}
+
+struct parallelRange {
+  pthread_t thread;
+  int worker;
+  int begin;
+  int end;
+  void (*fn)(int worker, int begin, int end, void* arg);
+  void* arg;
+};
+
+void* editorParallelRun(void* arg) {
+  struct parallelRange* range = arg;
+  range->fn(range->worker, range->begin, range->end, range->arg);
+  return NULL;
+}
+
+/*
+  * Split `0..count` into one contiguous range per worker
+  * and run `fn` on all of them at once. The calling
+  * thread takes the first range itself. Return the number
+  * of workers used, so callers can size per worker
+  * results with `editorWorkerCount` beforehand.
+*/
+int editorParallelFor(int count, int workers,
+    void (*fn)(int worker, int begin, int end, void* arg), void* arg) {
+  struct parallelRange ranges[KILO_MAX_WORKERS];
+  for(int w = 0; w < workers; ++w) {
+    ranges[w].worker = w;
+    ranges[w].begin = (long long)count * w / workers;
+    ranges[w].end = (long long)count * (w + 1) / workers;
+    ranges[w].fn = fn;
+    ranges[w].arg = arg;
+  }
+  for(int w = 1; w < workers; ++w) {
+    if(pthread_create(&ranges[w].thread, NULL, editorParallelRun,
+          &ranges[w]) != 0) {
+      /*
+        * Fall back to doing the work ourselves
+      */
+      editorParallelRun(&ranges[w]);
+      ranges[w].worker = -1;
+    }
+  }
+  editorParallelRun(&ranges[0]);
+  for(int w = 1; w < workers; ++w) {
+    if(ranges[w].worker != -1) pthread_join(ranges[w].thread, NULL);
+  }
+  return workers;
+}
+
+double editorElapsedMs(struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000.0 +
+    (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+  * Rows with at least one match, found by one worker
+*/
+struct matchList {
+  int* rows;
+  int* counts;
+  int length;
+  int capacity;
+};
+
+struct replaceJob {
+  struct editorBuffer* buf;
+  const char* query;
+  int queryLength;
+  struct matchList lists[KILO_MAX_WORKERS];
+};
+
+void editorMatchListAdd(struct matchList* list, int row, int count) {
+  if(list->length == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+    list->rows = realloc(list->rows, sizeof(int) * list->capacity);
+    list->counts = realloc(list->counts, sizeof(int) * list->capacity);
+  }
+  list->rows[list->length] = row;
+  list->counts[list->length] = count;
+  list->length++;
+}
+
+/*
+  * Search rows from `i` on that lie back to back in
+  * memory with a single pass over all of them, rather
+  * than one search per row. The NUL ending each row
+  * keeps matches from running into the next one. Return
+  * the row the run ends at.
+*/
+int editorReplaceScanRun(struct replaceJob* job, struct matchList* list,
+    int i, int end) {
+  struct editorBuffer* buf = job->buf;
+  int bytes;
+  int runEnd = editorTextRun(buf, i, &bytes);
+  if(runEnd > end) {
+    runEnd = end;
+    bytes = buf->texts[end - 1] + buf->sizes[end - 1] + 1 - buf->texts[i];
+  }
+
+  const char* p = buf->texts[i];
+  const char* last = p + bytes;
+  int current = i;
+  const char* rowEnd = buf->texts[i] + buf->sizes[i];
+  int count = 0;
+  while((p = memmem(p, last - p, job->query, job->queryLength))) {
+    while(p > rowEnd) {
+      if(count) editorMatchListAdd(list, current, count);
+      count = 0;
+      current++;
+      rowEnd = buf->texts[current] + buf->sizes[current];
+    }
+    count++;
+    p += job->queryLength;
+  }
+  if(count) editorMatchListAdd(list, current, count);
+  return runEnd;
+}
+
+/*
+  * Count the matches in a range of rows. Resident rows
+  * are searched a run at a time, cold rows are
+  * decompressed into a buffer of the worker's own, the
+  * shared block cache is not safe to use from here.
+*/
+void editorReplaceScan(int worker, int begin, int end, void* arg) {
+  struct replaceJob* job = arg;
+  struct matchList* list = &job->lists[worker];
+  struct coldBlock* block = NULL;
+  char* blockData = NULL;
+
+  for(int i = begin; i < end; ++i) {
+    if(job->buf->texts[i]) {
+      i = editorReplaceScanRun(job, list, i, end) - 1;
+      continue;
+    }
+    erow* row = &job->buf->row[i];
+    if(row->cold != block) {
+      block = row->cold;
+      blockData = realloc(blockData, block->size ? block->size : 1);
+      editorColdBlockRead(block, blockData);
+    }
+    const char* text = blockData + row->coldOffset;
+
+    int count = 0;
+    const char* p = text;
+    const char* last = text + row->size;
+    while((p = memmem(p, last - p, job->query, job->queryLength))) {
+      count++;
+      p += job->queryLength;
+    }
+    if(count) editorMatchListAdd(list, i, count);
+  }
+  free(blockData);
+}
+
+/*
+  * Rebuild a row with every match replaced, in a single
+  * allocation. The row is rendered but not highlighted.
+*/
+void editorReplaceInRow(struct editorBuffer* buf, erow* row, int count,
+    const char* query, int queryLength, const char* with, int withLength) {
+  editorRowThawText(buf, row);
+  editorRowOwnText(buf, row);
+  editorRowAccount(buf, row, -1);
+
+  int size = row->size + count * (withLength - queryLength);
+  char* chars = malloc(size + 1);
+  char* out = chars;
+  const char* p = row->chars;
+  const char* last = row->chars + row->size;
+  const char* match;
+  while((match = memmem(p, last - p, query, queryLength))) {
+    memcpy(out, p, match - p);
+    out += match - p;
+    memcpy(out, with, withLength);
+    out += withLength;
+    p = match + queryLength;
+  }
+  memcpy(out, p, last - p);
+  chars[size] = '\0';
+
+  free(row->chars);
+  row->chars = chars;
+  row->size = size;
+  editorRowEdited(buf, row);
+  editorSyncRow(buf, row);
+  editorRenderRow(buf, row);
+  editorRowAccount(buf, row, 1);
+}
+
+/*
+  * Replace every occurrence of a string in the buffer.
+  * Matches are found by several threads at once, each
+  * row with matches is rebuilt once and highlighted
+  * once, and the screen is drawn once at the end.
+*/
+void editorReplaceAll() {
+  struct editorBuffer* buf = E.view->buf;
+  char* query = editorPrompt("Replace: %s (ESC to cancel)", NULL);
+  if(query == NULL) return;
+  char* with = editorPromptInput("Replace with: %s (ESC to cancel)",
+      NULL, 1);
+  if(with == NULL) {
+    free(query);
+    return;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct replaceJob job;
+  memset(&job, 0, sizeof(job));
+  job.buf = buf;
+  job.query = query;
+  job.queryLength = strlen(query);
+  int workers = editorWorkerCount(buf->numRows, KILO_ROWS_PER_WORKER);
+  editorParallelFor(buf->numRows, workers, editorReplaceScan, &job);
+
+  /*
+    * The workers cover consecutive ranges, so their
+    * lists come out in row order
+  */
+  int withLength = strlen(with);
+  int replaced = 0;
+  int rows = 0;
+  int first = -1;
+  for(int w = 0; w < workers; ++w) {
+    struct matchList* list = &job.lists[w];
+    for(int j = 0; j < list->length; ++j) {
+      editorReplaceInRow(buf, &buf->row[list->rows[j]], list->counts[j],
+          query, job.queryLength, with, withLength);
+      replaced += list->counts[j];
+      rows++;
+      if(first == -1) first = list->rows[j];
+    }
+  }
+
+  /*
+    * One highlight pass over the changed rows, going on
+    * past one only while its end state keeps changing
+  */
+  if(first != -1) {
+    int w = 0;
+    int j = 0;
+    int pending = 0;
+    for(int i = first; i < buf->numRows; ++i) {
+      while(w < workers && j == job.lists[w].length) {
+        w++;
+        j = 0;
+      }
+      int changed = w < workers && job.lists[w].rows[j] == i;
+      if(changed) j++;
+      if(!changed && !pending) {
+        if(w == workers) break;
+        continue;
+      }
+      pending = editorHighlightRow(buf, &buf->row[i]);
+    }
+  }
+
+  for(int w = 0; w < workers; ++w) {
+    free(job.lists[w].rows);
+    free(job.lists[w].counts);
+  }
+  /*
+    * Rows may have got shorter under a cursor
+  */
+  for(int i = 0; i < E.numViews; ++i) {
+    struct editorView* view = E.views[i];
+    if(view->buf == buf && view->cy < buf->numRows &&
+        view->cx > buf->row[view->cy].size)
+      view->cx = buf->row[view->cy].size;
+  }
+  buf->dirty += replaced;
+  editorSetStatusMessage("Replaced %d occurrences in %d rows in %.1f ms",
+      replaced, rows, editorElapsedMs(&start));
+  free(query);
+  free(with);
+}
+
+/*
+  * The rows a line command works on: those of the region
+  * when the mark is set, leaving out a last row the
+  * region ends at the start of, or else the whole buffer.
+  * Return the number of rows.
+*/
+int editorLineRange(struct editorView* view, int* first) {
+  struct editorBuffer* buf = view->buf;
+  int r1, c1, r2, c2;
+  *first = 0;
+  if(!editorRegion(view, &r1, &c1, &r2, &c2)) return buf->numRows;
+  if(r2 > r1 && c2 == 0) r2--;
+  *first = r1;
+  return r2 - r1 + 1;
+}
+
+/*
+  * The state each row of `first..first+count-1` starts in,
+  * taken before the rows are moved or dropped
+*/
+unsigned char* editorStartStates(struct editorBuffer* buf, int first,
+    int count) {
+  unsigned char* starts = malloc(count ? count : 1);
+  for(int k = 0; k < count; ++k)
+    starts[k] = first + k > 0 ? buf->row[first + k - 1].hlOpenComment : 0;
+  return starts;
+}
+
+/*
+  * Highlight again, in one pass, the rows now at
+  * `first..first+count-1` that follow a row ending in
+  * another state than the one they started in before,
+  * `starts` giving that state for each. `next` is the
+  * state the row after them started in.
+*/
+void editorHighlightMoved(struct editorBuffer* buf, int first, int count,
+    const unsigned char* starts, int next) {
+  int* rows = malloc(sizeof(int) * (count + 1));
+  int numRows = 0;
+  for(int k = 0; k <= count && first + k < buf->numRows; ++k) {
+    int i = first + k;
+    int start = i > 0 ? buf->row[i - 1].hlOpenComment : 0;
+    if(start != (k < count ? starts[k] : next)) rows[numRows++] = i;
+  }
+  editorHighlightRows(buf, rows, numRows);
+  free(rows);
+}
+
+/*
+  * Sort keys point at the text of a row, which is never
+  * copied. Equal rows keep their order.
+*/
+struct sortKey {
+  const char* text;
+  int size;
+  int row;
+};
+
+int editorSortKeyLess(const struct sortKey* a, const struct sortKey* b) {
+  int n = a->size < b->size ? a->size : b->size;
+  int c = memcmp(a->text, b->text, n);
+  if(c) return c < 0;
+  if(a->size != b->size) return a->size < b->size;
+  return a->row < b->row;
+}
+
+void editorMergeKeys(const struct sortKey* a, int na,
+    const struct sortKey* b, int nb, struct sortKey* out) {
+  int i = 0;
+  int j = 0;
+  while(i < na && j < nb)
+    *out++ = editorSortKeyLess(&b[j], &a[i]) ? b[j++] : a[i++];
+  memcpy(out, &a[i], sizeof(struct sortKey) * (na - i));
+  memcpy(out + (na - i), &b[j], sizeof(struct sortKey) * (nb - j));
+}
+
+/*
+  * Merge sort `count` keys bottom up, runs of 16 being
+  * sorted by insertion first. The result ends up back
+  * in `keys`.
+*/
+void editorSortKeys(struct sortKey* keys, struct sortKey* tmp, int count) {
+  for(int start = 0; start < count; start += 16) {
+    int end = start + 16 < count ? start + 16 : count;
+    for(int i = start + 1; i < end; ++i) {
+      struct sortKey key = keys[i];
+      int j = i;
+      while(j > start && editorSortKeyLess(&key, &keys[j - 1])) {
+        keys[j] = keys[j - 1];
+        j--;
+      }
+      keys[j] = key;
+    }
+  }
+  struct sortKey* src = keys;
+  struct sortKey* dst = tmp;
+  for(int width = 16; width < count; width *= 2) {
+    for(int start = 0; start < count; start += 2 * width) {
+      int mid = start + width < count ? start + width : count;
+      int end = start + 2 * width < count ? start + 2 * width : count;
+      editorMergeKeys(&src[start], mid - start, &src[mid], end - mid,
+          &dst[start]);
+    }
+    struct sortKey* swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if(src != keys) memcpy(keys, src, sizeof(struct sortKey) * count);
+}
+
+struct sortJob {
+  struct sortKey* keys;
+  struct sortKey* tmp;
+  int count;
+  int runs;
+  /*
+    * Where the run of each worker starts, and the end
+  */
+  int bounds[KILO_MAX_WORKERS + 1];
+};
+
+void editorSortRun(int worker, int begin, int end, void* arg) {
+  struct sortJob* job = arg;
+  (void)worker;
+  editorSortKeys(&job->keys[begin], &job->tmp[begin], end - begin);
+}
+
+/*
+  * Merge runs `2 * pair` and `2 * pair + 1` of `keys` into
+  * `tmp`, a run left without a partner is copied
+*/
+void editorMergeRuns(int worker, int begin, int end, void* arg) {
+  struct sortJob* job = arg;
+  (void)worker;
+  for(int pair = begin; pair < end; ++pair) {
+    int a = job->bounds[2 * pair];
+    int mid = job->bounds[2 * pair + 1 < job->runs ? 2 * pair + 1 :
+      job->runs];
+    int b = job->bounds[2 * pair + 2 < job->runs ? 2 * pair + 2 :
+      job->runs];
+    editorMergeKeys(&job->keys[a], mid - a, &job->keys[mid], b - mid,
+        &job->tmp[a]);
+  }
+}
+
+/*
+  * Sort the keys with one run per worker, then merge the
+  * runs pairwise, the merges of a round running at once
+*/
+void editorParallelSort(struct sortKey* keys, int count) {
+  struct sortJob job;
+  job.keys = keys;
+  job.tmp = malloc(sizeof(struct sortKey) * (count ? count : 1));
+  job.count = count;
+  job.runs = editorWorkerCount(count, KILO_ROWS_PER_WORKER);
+  for(int w = 0; w <= job.runs; ++w)
+    job.bounds[w] = (long long)count * w / job.runs;
+  editorParallelFor(count, job.runs, editorSortRun, &job);
+
+  while(job.runs > 1) {
+    int pairs = (job.runs + 1) / 2;
+    editorParallelFor(pairs, pairs, editorMergeRuns, &job);
+    struct sortKey* swap = job.keys;
+    job.keys = job.tmp;
+    job.tmp = swap;
+    for(int p = 0; p < pairs; ++p) job.bounds[p] = job.bounds[2 * p];
+    job.bounds[pairs] = count;
+    job.runs = pairs;
+  }
+  if(job.keys != keys) {
+    memcpy(keys, job.keys, sizeof(struct sortKey) * count);
+    job.tmp = job.keys;
+  }
+  free(job.tmp);
+}
+
+/*
+  * Get the rows a line command works on ready: one
+  * cursor, text in memory, and nothing pointing into
+  * the rows that are about to move
+*/
+struct editorBuffer* editorLineCommandStart(int* first, int* count) {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  editorDropCursors(view);
+  *count = editorLineRange(view, first);
+  view->markSet = 0;
+  for(int i = *first; i < *first + *count; ++i)
+    editorRowThawText(buf, &buf->row[i]);
+  if(E.match.buf == buf) E.match.buf = NULL;
+  if(E.bracket.buf == buf) E.bracket.buf = NULL;
+  return buf;
+}
+
+void editorLineCommandEnd(struct editorBuffer* buf, int first) {
+  editorRowsMoved(buf, first);
+  buf->dirty++;
+  for(int i = 0; i < E.numViews; ++i) {
+    struct editorView* view = E.views[i];
+    if(view->buf != buf) continue;
+    if(view->cy > buf->numRows) view->cy = buf->numRows;
+    view->cx = 0;
+  }
+}
+
+/*
+  * Sort the rows of the region, or of the buffer, by
+  * their bytes. Only the row structs are moved, once,
+  * after the keys pointing at their text are sorted.
+*/
+void editorSortLines() {
+  int first, count;
+  struct editorBuffer* buf = editorLineCommandStart(&first, &count);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct sortKey* keys = malloc(sizeof(struct sortKey) * (count ? count : 1));
+  for(int k = 0; k < count; ++k) {
+    keys[k].text = buf->texts[first + k];
+    keys[k].size = buf->sizes[first + k];
+    keys[k].row = k;
+  }
+  editorParallelSort(keys, count);
+
+  unsigned char* oldStarts = editorStartStates(buf, first, count);
+  int next = count ? buf->row[first + count - 1].hlOpenComment : 0;
+  unsigned char* starts = malloc(count ? count : 1);
+  erow* rows = malloc(sizeof(erow) * (count ? count : 1));
+  for(int k = 0; k < count; ++k) {
+    rows[k] = buf->row[first + keys[k].row];
+    starts[k] = oldStarts[keys[k].row];
+  }
+  memcpy(&buf->row[first], rows, sizeof(erow) * count);
+  for(int k = 0; k < count; ++k) {
+    buf->row[first + k].idx = first + k;
+    editorSyncRow(buf, &buf->row[first + k]);
+    if(keys[k].row != k) editorRowTouch(buf, &buf->row[first + k]);
+  }
+  free(rows);
+  free(keys);
+  free(oldStarts);
+
+  editorHighlightMoved(buf, first, count, starts, next);
+  free(starts);
+  editorLineCommandEnd(buf, first);
+  editorSetStatusMessage("Sorted %d lines in %.1f ms", count,
+      editorElapsedMs(&start));
+}
+
+/*
+  * Drop the rows of `first..first+count-1` whose `keep`
+  * is 0 in one pass, moving the others up once, then
+  * highlight again the rows that now start out in
+  * another state. Return the number of rows dropped.
+*/
+int editorCompactRows(struct editorBuffer* buf, int first, int count,
+    const unsigned char* keep) {
+  unsigned char* oldStarts = editorStartStates(buf, first, count);
+  int next = count ? buf->row[first + count - 1].hlOpenComment : 0;
+  unsigned char* starts = malloc(count ? count : 1);
+  int kept = 0;
+  for(int k = 0; k < count; ++k) {
+    erow* row = &buf->row[first + k];
+    if(!keep[k]) {
+      editorFreeRow(buf, row);
+      continue;
+    }
+    starts[kept] = oldStarts[k];
+    if(kept != k) {
+      buf->row[first + kept] = *row;
+      buf->row[first + kept].idx = first + kept;
+      editorSyncRow(buf, &buf->row[first + kept]);
+    }
+    kept++;
+  }
+  int dropped = count - kept;
+  int after = buf->numRows - first - count;
+  memmove(&buf->row[first + kept], &buf->row[first + count],
+      sizeof(erow) * after);
+  memmove(&buf->sizes[first + kept], &buf->sizes[first + count],
+      sizeof(int) * after);
+  memmove(&buf->texts[first + kept], &buf->texts[first + count],
+      sizeof(char*) * after);
+  buf->numRows -= dropped;
+  for(int i = first + kept; i < buf->numRows; ++i) buf->row[i].idx -= dropped;
+
+  editorHighlightMoved(buf, first, kept, starts, next);
+  free(starts);
+  free(oldStarts);
+  return dropped;
+}
+
+/*
+  * Drop each row that repeats the one above it
+*/
+void editorUniqLines() {
+  int first, count;
+  struct editorBuffer* buf = editorLineCommandStart(&first, &count);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  unsigned char* keep = malloc(count ? count : 1);
+  for(int k = 0; k < count; ++k) {
+    int i = first + k;
+    keep[k] = k == 0 || buf->sizes[i] != buf->sizes[i - 1] ||
+      memcmp(buf->texts[i], buf->texts[i - 1], buf->sizes[i]) != 0;
+  }
+  int dropped = editorCompactRows(buf, first, count, keep);
+  free(keep);
+  editorLineCommandEnd(buf, first);
+  editorSetStatusMessage("Removed %d repeated lines in %.1f ms", dropped,
+      editorElapsedMs(&start));
+}
+
+struct filterJob {
+  struct editorBuffer* buf;
+  int first;
+  const char* query;
+  int queryLength;
+  int drop;
+  unsigned char* keep;
+};
+
+void editorFilterScan(int worker, int begin, int end, void* arg) {
+  struct filterJob* job = arg;
+  (void)worker;
+  for(int k = begin; k < end; ++k) {
+    int i = job->first + k;
+    int found = memmem(job->buf->texts[i], job->buf->sizes[i], job->query,
+        job->queryLength) != NULL;
+    job->keep[k] = found != job->drop;
+  }
+}
+
+/*
+  * Keep only the rows containing a string, or with
+  * `drop` only the rows that don't. The rows are looked
+  * at by several threads at once, then dropped in one
+  * pass.
+*/
+void editorFilterLines(int drop) {
+  char* query = editorPrompt(drop ?
+      "Drop lines containing: %s (ESC to cancel)" :
+      "Keep lines containing: %s (ESC to cancel)", NULL);
+  if(query == NULL) return;
+  int first, count;
+  struct editorBuffer* buf = editorLineCommandStart(&first, &count);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct filterJob job;
+  job.buf = buf;
+  job.first = first;
+  job.query = query;
+  job.queryLength = strlen(query);
+  job.drop = drop;
+  job.keep = malloc(count ? count : 1);
+  editorParallelFor(count, editorWorkerCount(count, KILO_ROWS_PER_WORKER),
+      editorFilterScan, &job);
+  int dropped = editorCompactRows(buf, first, count, job.keep);
+  free(job.keep);
+  free(query);
+  editorLineCommandEnd(buf, first);
+  editorSetStatusMessage("Kept %d of %d lines in %.1f ms", count - dropped,
+      count, editorElapsedMs(&start));
+}
+
+/*
+  * Create an empty buffer and register it so that it
+  * can be reached from any window
+*/
+struct editorBuffer* editorNewBuffer() {
+  struct editorBuffer* buf = malloc(sizeof(struct editorBuffer));
+  buf->numRows = 0;
+  buf->rowCapacity = 0;
+  buf->row = NULL;
+  buf->dirty = 0;
+  buf->filename = NULL;
+  buf->syntax = NULL;
+  memset(buf->memory, 0, sizeof(buf->memory));
+  buf->sizes = NULL;
+  buf->texts = NULL;
+  buf->staleRows = 0;
+  buf->words.nodes = NULL;
+  buf->words.numNodes = 0;
+  buf->words.capacity = 0;
+  buf->words.cache = NULL;
+  buf->wordsPending = 0;
+  buf->brackets.nodes = NULL;
+  buf->brackets.leaves = 0;
+  buf->brackets.rows = 0;
+  buf->brackets.validRows = 0;
+  buf->wrap.tree = NULL;
+  buf->wrap.size = 0;
+  buf->wrap.capacity = 0;
+  buf->wrap.width = 0;
+  buf->wrap.valid = 0;
+  memset(&buf->stats, 0, sizeof(buf->stats));
+  buf->disk = NULL;
+  buf->numDisk = 0;
+  buf->diskCapacity = 0;
+  buf->diskKnown = 0;
+
+  E.buffers = realloc(E.buffers,
+      sizeof(struct editorBuffer*) * (E.numBuffers + 1));
+  E.buffers[E.numBuffers++] = buf;
+  return buf;
+}
+
+/*
+  * Release a buffer and all of its rows
+*/
+void editorFreeBuffer(struct editorBuffer* buf) {
+  if(stream.buf == buf) editorCloseStream();
+  for(int i = 0; i < buf->numRows; ++i) {
+    editorFreeRow(buf, &buf->row[i]);
+  }
+  free(buf->row);
+  free(buf->sizes);
+  free(buf->texts);
+  free(buf->disk);
+  free(buf->words.nodes);
+  free(buf->words.cache);
+  free(buf->brackets.nodes);
+  free(buf->wrap.tree);
+  free(buf->filename);
+
+  for(int i = 0; i < E.numBuffers; ++i) {
+    if(E.buffers[i] == buf) {
+      memmove(&E.buffers[i], &E.buffers[i + 1],
+          sizeof(struct editorBuffer*) * (E.numBuffers - i - 1));
+      E.numBuffers--;
+      break;
+    }
+  }
+  free(buf);
+}
+
+/*
+  * Find an open buffer by its file name
+*/
+struct editorBuffer* editorFindBuffer(char* filename) {
+  for(int i = 0; i < E.numBuffers; ++i) {
+    if(E.buffers[i]->filename && !strcmp(E.buffers[i]->filename, filename))
+      return E.buffers[i];
+  }
+  return NULL;
+}
+
+/*
+  * Share out the text area between the windows. Each
+  * window gets one line for its own status bar.
+*/
+void editorLayoutViews() {
+  int top = 0;
+  for(int i = 0; i < E.numViews; ++i) {
+    struct editorView* view = E.views[i];
+    int height = E.screenRows / E.numViews;
+    if(i == E.numViews - 1)
+      height = E.screenRows - top;
+    view->top = top;
+    view->screenRows = height - 1;
+    view->screenCols = E.screenCols;
+    top += height;
+  }
+}
+
+struct editorView* editorNewView(struct editorBuffer* buf, int at) {
+  struct editorView* view = malloc(sizeof(struct editorView));
+  view->buf = buf;
+  view->cx = 0;
+  view->cy = 0;
+  view->rx = 0;
+  view->rowOff = 0;
+  view->colOff = 0;
+  view->wrap = 0;
+  view->lineOff = 0;
+  view->cursors = NULL;
+  view->numCursors = 0;
+  view->primary = 0;
+  view->markSet = 0;
+  view->drawnBuf = NULL;
+  view->drawnRows = 0;
+
+  E.views = realloc(E.views, sizeof(struct editorView*) * (E.numViews + 1));
+  memmove(&E.views[at + 1], &E.views[at],
+      sizeof(struct editorView*) * (E.numViews - at));
+  E.views[at] = view;
+  E.numViews++;
+  editorLayoutViews();
+  return view;
+}
+
+void editorSelectView(int index) {
+  E.currentView = index;
+  E.view = E.views[index];
+}
+
+/*
+  * Show a buffer in the current window
+*/
+void editorViewSetBuffer(struct editorView* view, struct editorBuffer* buf) {
+  if(view->buf == buf) return;
+  view->buf = buf;
+  view->cx = 0;
+  view->cy = 0;
+  view->rx = 0;
+  view->rowOff = 0;
+  view->colOff = 0;
+  view->lineOff = 0;
+  editorDropCursors(view);
+  view->markSet = 0;
+}
+
+/*
+  * Split the current window in two, both halves
+  * showing the same buffer
+*/
+void editorSplitView() {
+  if(E.screenRows / (E.numViews + 1) < 2) {
+    editorSetStatusMessage("Window too small to split");
+    return;
+  }
+  struct editorView* view = E.view;
+  struct editorView* split = editorNewView(view->buf, E.currentView + 1);
+  split->cx = view->cx;
+  split->cy = view->cy;
+  split->rowOff = view->rowOff;
+  split->colOff = view->colOff;
+  split->wrap = view->wrap;
+  split->lineOff = view->lineOff;
+}
+
+void editorCloseView() {
+  if(E.numViews == 1) {
+    editorSetStatusMessage("Can't close the only window");
+    return;
+  }
+  int at = E.currentView;
+  free(E.views[at]->cursors);
+  free(E.views[at]);
+  memmove(&E.views[at], &E.views[at + 1],
+      sizeof(struct editorView*) * (E.numViews - at - 1));
+  E.numViews--;
+  editorLayoutViews();
+  editorSelectView(at == E.numViews ? at - 1 : at);
+}
+
+void editorCloseOtherViews() {
+  struct editorView* view = E.view;
+  for(int i = 0; i < E.numViews; ++i) {
+    if(E.views[i] != view) {
+      free(E.views[i]->cursors);
+      free(E.views[i]);
+    }
+  }
+  E.views[0] = view;
+  E.numViews = 1;
+  editorLayoutViews();
+  editorSelectView(0);
+}
+
+void editorNextBuffer() {
+  struct editorBuffer* buf = E.view->buf;
+  int at = 0;
+  for(int i = 0; i < E.numBuffers; ++i) {
+    if(E.buffers[i] == buf) at = i;
+  }
+  buf = E.buffers[(at + 1) % E.numBuffers];
+  editorViewSetBuffer(E.view, buf);
+  editorSetStatusMessage("Buffer %d/%d: %.20s (%zu bytes)",
+      (at + 1) % E.numBuffers + 1, E.numBuffers,
+      buf->filename ? buf->filename : "[No Name]",
+      editorBufferMemory(buf, NULL));
+}
 
-        } else {
-          int color = editorSyntaxToColor(highlight[i]);
-          if (color != currentColor) {
-            currentColor = color;
-            char buffer[16];
-            int colorLength = snprintf(buffer, sizeof(buffer), "\x1b[%dm", color);
-            bufferAppend(buf, buffer, colorLength);
-          }
-          bufferAppend(buf, &c[i], 1);
-        }
+/*
+  * Close the buffer of the current window. Windows
+  * showing it move on to another buffer.
+*/
+void editorKillBuffer() {
+  struct editorBuffer* buf = E.view->buf;
+  if(editorBufferModified(buf)) {
+    editorSetStatusMessage("Buffer has unsaved changes, save it first");
+    return;
+  }
+  struct editorBuffer* next = NULL;
+  for(int i = 0; i < E.numBuffers; ++i) {
+    if(E.buffers[i] != buf) next = E.buffers[i];
+  }
+  if(next == NULL) next = editorNewBuffer();
+  for(int i = 0; i < E.numViews; ++i) {
+    if(E.views[i]->buf == buf) editorViewSetBuffer(E.views[i], next);
+  }
+  editorFreeBuffer(buf);
+}
+
+/*
+  * Show a file in the current window, reusing its
+  * buffer when the file is already open. Return the
+  * buffer, or NULL when the file can't be read.
+*/
+struct editorBuffer* editorVisitFile(char* filename) {
+  struct editorBuffer* buf = editorFindBuffer(filename);
+  if(buf == NULL) {
+    buf = editorNewBuffer();
+    if(editorOpen(buf, filename) == -1) {
+      if(errno != ENOENT) {
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        editorFreeBuffer(buf);
+        return NULL;
       }
-      bufferAppend(buf, "\x1b[39m", 5);
+      editorSetStatusMessage("(New file)");
     }
+  }
+  editorViewSetBuffer(E.view, buf);
+  return buf;
+}
+
+void editorOpenFile() {
+  char* filename = editorPrompt("Open file: %s (ESC to cancel)", NULL);
+  if(filename == NULL) return;
+  editorVisitFile(filename);
+  free(filename);
+}
+
+struct appendBuf {
+  char* buf;
+  int length;
+};
+
+#define ABUF_INIT {NULL, 0}
+
+/*
+ * Use `realloc` to request much more memory
+*/
+void bufferAppend(struct appendBuf* buf, const char* s, int length) {
+  char* new = realloc(buf->buf, buf->length + length);
+
+  if(new == NULL) return;
+  memcpy(&new[buf->length], s, length);
+  buf->buf = new;
+  buf->length += length;
+}
+
+/*
+ * Free the memory
+*/
+void bufferFree(struct appendBuf* buf) {
+  free(buf->buf);
+}
+
+/*
+  * Measure rows that were never rendered. Cold rows are
+  * left to the calling thread, their text is only read
+  * through the shared block cache.
+*/
+struct wrapJob {
+  struct editorBuffer* buf;
+  int from;
+};
+
+void editorWrapMeasure(int worker, int begin, int end, void* arg) {
+  (void)worker;
+  struct wrapJob* job = arg;
+  for(int i = job->from + begin; i < job->from + end; ++i) {
+    erow* row = &job->buf->row[i];
+    if(row->columns < 0 && row->cold == NULL)
+      row->columns = editorTextColumns(row->chars, row->size, 0);
+  }
+}
+
+/*
+  * The wrap layout of a buffer for windows `width`
+  * columns wide. It is built over all rows the first
+  * time and after rows were added or removed, and grows
+  * row by row when they were only added at the end.
+*/
+struct wrapLayout* editorWrapLayout(struct editorBuffer* buf, int width) {
+  struct wrapLayout* wrap = &buf->wrap;
+  if(wrap->valid && wrap->width == width && wrap->size == buf->numRows)
+    return wrap;
+
+  int from = wrap->valid && wrap->width == width &&
+    wrap->size < buf->numRows ? wrap->size : 0;
+  int count = buf->numRows - from;
+  int workers = editorWorkerCount(count, KILO_ROWS_PER_WORKER);
+  if(workers > 1) {
+    struct wrapJob job = {buf, from};
+    editorParallelFor(count, workers, editorWrapMeasure, &job);
+  }
+  for(int i = from; i < buf->numRows; ++i) {
+    erow* row = &buf->row[i];
+    if(row->columns < 0)
+      row->columns = editorTextColumns(editorRowText(row), row->size, 0);
+  }
 
+  if(buf->numRows + 1 > wrap->capacity) {
+    wrap->capacity = buf->numRows + 1 + buf->numRows / 2;
+    wrap->tree = realloc(wrap->tree, sizeof(int) * wrap->capacity);
+  }
+  wrap->tree[0] = 0;
+  wrap->width = width;
+  if(from > 0) {
     /*
-      * We shouldn't write `\r\n` to the last line
-      * because this causes terminal to scroll in
-      * order to make room for a new, blank line.
+      * Node `i` sums the rows `i - (i & -i) .. i - 1`,
+      * all but the last of which are in the tree already
     */
+    for(int i = from + 1; i <= buf->numRows; ++i) {
+      int lines = editorWrapLines(buf->row[i - 1].columns, width);
+      wrap->tree[i] = lines + editorWrapLine(wrap, i - 1) -
+        editorWrapLine(wrap, i - (i & -i));
+    }
+  } else {
+    for(int i = 1; i <= buf->numRows; ++i)
+      wrap->tree[i] = editorWrapLines(buf->row[i - 1].columns, width);
+    for(int i = 1; i <= buf->numRows; ++i) {
+      int parent = i + (i & -i);
+      if(parent <= buf->numRows) wrap->tree[parent] += wrap->tree[i];
+    }
+  }
+  wrap->size = buf->numRows;
+  wrap->valid = 1;
+  return wrap;
+}
+
+/*
+  * Screen line of its row the cursor of a wrapped
+  * window is on
+*/
+int editorWrapCursorLine(struct editorView* view) {
+  struct editorBuffer* buf = view->buf;
+  if(view->cy >= buf->numRows) return 0;
+  int line = view->rx / view->screenCols;
+  int lines = editorWrapLines(buf->row[view->cy].columns, view->screenCols);
+  return line < lines ? line : lines - 1;
+}
+
+/*
+  * First line of the buffer a window shows, counting
+  * screen lines when it wraps
+*/
+int editorViewTopLine(struct editorView* view) {
+  if(!view->wrap) return view->rowOff;
+  return editorWrapLine(&view->buf->wrap, view->rowOff) + view->lineOff;
+}
+
+/*
+  * Keep the screen line of the cursor inside a wrapped
+  * window. Rows above the window may have been edited
+  * in another one, so `lineOff` may be past the end of
+  * its row by now.
+*/
+void editorScrollWrapped(struct editorView* view) {
+  struct editorBuffer* buf = view->buf;
+  struct wrapLayout* wrap = editorWrapLayout(buf, view->screenCols);
+  view->colOff = 0;
+  if(view->rowOff > buf->numRows) view->rowOff = buf->numRows;
+  int lines = view->rowOff < buf->numRows ?
+    editorWrapLines(buf->row[view->rowOff].columns, view->screenCols) : 1;
+  if(view->lineOff >= lines) view->lineOff = lines - 1;
+
+  int top = editorViewTopLine(view);
+  int cursor = editorWrapLine(wrap, view->cy) + editorWrapCursorLine(view);
+  if(cursor < top) top = cursor;
+  if(cursor >= top + view->screenRows) top = cursor - view->screenRows + 1;
+  view->rowOff = editorWrapFind(wrap, top, &view->lineOff);
+}
+
+/*
+  * Page up or down in a wrapped window, by screen lines.
+  * The cursor keeps its column on screen, which may take
+  * it into the middle of a long row.
+*/
+void editorPageWrapped(struct editorView* view, int direction) {
+  struct editorBuffer* buf = view->buf;
+  struct wrapLayout* wrap = editorWrapLayout(buf, view->screenCols);
+  int line = editorViewTopLine(view);
+  if(direction < 0) line -= view->screenRows;
+  else line += 2 * view->screenRows - 1;
+  if(line < 0) line = 0;
+  int offset;
+  view->cy = editorWrapFind(wrap, line, &offset);
+  if(view->cy >= buf->numRows) {
+    view->cy = buf->numRows;
+    return;
+  }
+  erow* row = &buf->row[view->cy];
+  editorRowThaw(buf, row);
+  view->cx = editorRowRxToCx(buf, row,
+      offset * view->screenCols + view->rx % view->screenCols);
+}
+
+/*
+  * Wrap long rows in the current window, or go back to
+  * scrolling them sideways
+*/
+void editorToggleWrap() {
+  struct editorView* view = E.view;
+  view->wrap = !view->wrap;
+  view->lineOff = 0;
+  editorSetStatusMessage(view->wrap ? "Wrapping long lines" :
+      "Not wrapping long lines");
+}
+
+/*
+  * Check if the cursor has moved outside of the
+  * visible window, and if so, adjust `view->rowOff`
+  * so that the cursor is just inside the visible
+  * window.
+*/
+void editorScroll(struct editorView* view) {
+  struct editorBuffer* buf = view->buf;
+
+  /*
+    * Another window may have changed the buffer
+    * under our cursor
+  */
+  if(view->cy > buf->numRows) view->cy = buf->numRows;
+  if(view->cy < buf->numRows) editorRowThaw(buf, &buf->row[view->cy]);
+  int rowLength = view->cy < buf->numRows ? buf->row[view->cy].size : 0;
+  if(view->cx > rowLength) view->cx = rowLength;
+  while(view->cx > 0 && view->cx < rowLength &&
+      editorIsContinuationByte(buf->row[view->cy].chars[view->cx]))
+    view->cx--;
+
+  view->rx = 0;
+  if(view->cy < buf->numRows) {
+    view->rx = editorRowCxToRx(buf, &buf->row[view->cy], view->cx);
+  }
+
+  if(view->wrap) {
+    editorScrollWrapped(view);
+    return;
+  }
+  if(view->cy < view->rowOff) {
+    view->rowOff = view->cy;
+  }
+  if(view->cy >= view->rowOff + view->screenRows) {
+    view->rowOff = view->cy - view->screenRows + 1;
+  }
+  if(view->rx < view->colOff) {
+    view->colOff = view->rx;
+  }
+  if(view->rx >= view->colOff + view->screenCols) {
+    view->colOff = view->rx - view->screenCols + 1;
+  }
+}
+
+/*
+  * Walks the spans of a render from left to right, with
+  * the search match laid over them
+*/
+struct spanWalker {
+  struct hlSpan* spans;
+  int numSpans;
+  int index;
+  int end;
+  int matchStart;
+  int matchEnd;
+  int bracketAt;
+  /*
+    * Render ranges of the extra cursors and selections
+    * on the row, as start and end pairs
+  */
+  int* marks;
+  int numMarks;
+  int markIndex;
+};
+
+/*
+  * The ranges the cursors of the current window cover on
+  * a row, besides the terminal's own cursor, or the part
+  * of the region on it. They are kept in one array
+  * reused for every row drawn.
+*/
+int editorCursorMarks(struct editorBuffer* buf, erow* row, int** marks) {
+  static int* ranges = NULL;
+  static int capacity = 0;
+  struct editorView* view = E.view;
+  int count = 0;
+  if(view->buf != buf) return 0;
+  int r1, c1, r2, c2;
+  if(editorRegion(view, &r1, &c1, &r2, &c2)) {
+    if(row->idx < r1 || row->idx > r2) return 0;
+    int start = row->idx == r1 ? c1 : 0;
+    int end = row->idx == r2 ? c2 : row->size;
+    if(start == end) return 0;
+    if(capacity == 0) {
+      capacity = 16;
+      ranges = malloc(sizeof(int) * 2 * capacity);
+    }
+    ranges[0] = editorRenderOffset(row->chars, start, 0);
+    ranges[1] = editorRenderOffset(row->chars, end, 0);
+    *marks = ranges;
+    return 1;
+  }
+  for(int i = editorFirstCursor(view, row->idx);
+      i < view->numCursors && view->cursors[i].cy == row->idx; ++i) {
+    struct editorCursor* cursor = &view->cursors[i];
+    if(cursor->cx == cursor->anchor && i == view->primary) continue;
+    int start = cursor->cx < cursor->anchor ? cursor->cx : cursor->anchor;
+    int end = cursor->cx < cursor->anchor ? cursor->anchor : cursor->cx;
+    if(end > row->size) end = row->size;
+    if(start > end) start = end;
+    if(count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      ranges = realloc(ranges, sizeof(int) * 2 * capacity);
+    }
+    ranges[2 * count] = editorRenderOffset(row->chars, start, 0);
+    ranges[2 * count + 1] = start == end ? ranges[2 * count] + 1 :
+      editorRenderOffset(row->chars, end, 0);
+    count++;
+  }
+  *marks = ranges;
+  return count;
+}
+
+/*
+  * Whether a cursor other than the terminal's sits past
+  * the end of a row, where there is no character to
+  * mark
+*/
+int editorCursorAtEnd(struct editorView* view, erow* row) {
+  for(int i = editorFirstCursor(view, row->idx);
+      i < view->numCursors && view->cursors[i].cy == row->idx; ++i) {
+    struct editorCursor* cursor = &view->cursors[i];
+    if(i != view->primary && cursor->cx >= row->size &&
+        cursor->anchor >= row->size)
+      return 1;
+  }
+  return 0;
+}
+
+void editorSpanStart(struct spanWalker* walker, struct editorBuffer* buf,
+    erow* row, int chunk, struct hlSpan* spans, int numSpans) {
+  walker->spans = spans;
+  walker->numSpans = numSpans;
+  walker->index = 0;
+  walker->end = numSpans ? spans[0].length : 0;
+  walker->matchStart = walker->matchEnd = -1;
+  if(E.match.buf == buf && E.match.row == row->idx &&
+      E.match.chunk == chunk) {
+    walker->matchStart = E.match.start;
+    walker->matchEnd = E.match.start + E.match.length;
+  }
+  walker->bracketAt = -1;
+  if(E.bracket.buf == buf && E.bracket.row == row->idx && chunk == -1)
+    walker->bracketAt = E.bracket.start;
+  walker->numMarks = 0;
+  walker->markIndex = 0;
+  if(chunk == -1)
+    walker->numMarks = editorCursorMarks(buf, row, &walker->marks);
+}
 
+/*
+  * Highlight at render offset `at`, which may only grow
+  * between calls. `*runEnd` is set to where it stops
+  * applying.
+*/
+unsigned char editorSpanAt(struct spanWalker* walker, int at, int* runEnd) {
+  while(at >= walker->end && walker->index < walker->numSpans) {
+    walker->index++;
+    if(walker->index < walker->numSpans)
+      walker->end += walker->spans[walker->index].length;
+  }
+  while(walker->markIndex < walker->numMarks &&
+      at >= walker->marks[2 * walker->markIndex + 1])
+    walker->markIndex++;
+  int markStart = INT_MAX;
+  if(walker->markIndex < walker->numMarks) {
+    markStart = walker->marks[2 * walker->markIndex];
+    if(at >= markStart) {
+      *runEnd = walker->marks[2 * walker->markIndex + 1];
+      return HL_SELECTION;
+    }
+  }
+  if(at >= walker->matchStart && at < walker->matchEnd) {
+    *runEnd = walker->matchEnd;
+    if(markStart < *runEnd) *runEnd = markStart;
+    return HL_MATCH;
+  }
+  if(at == walker->bracketAt) {
+    *runEnd = at + 1;
+    return HL_BRACKET;
+  }
+  unsigned char highlight = HL_NORMAL;
+  *runEnd = INT_MAX;
+  if(walker->index < walker->numSpans) {
+    highlight = walker->spans[walker->index].highlight;
+    *runEnd = walker->end;
+  }
+  if(at < walker->matchStart && walker->matchStart < *runEnd)
+    *runEnd = walker->matchStart;
+  if(at < walker->bracketAt && walker->bracketAt < *runEnd)
+    *runEnd = walker->bracketAt;
+  if(markStart < *runEnd) *runEnd = markStart;
+  return highlight;
+}
+
+/*
+  * Append one character of a row, switching colors
+  * only when the highlight changes
+*/
+void editorDrawChar(struct appendBuf* buf, char* c, int length,
+    unsigned char highlight, int* currentColor) {
+  if(length == 1 && (iscntrl((unsigned char)c[0]) ||
+        ((unsigned char)c[0] & 0x80))) {
+    char sym = ((unsigned char)c[0] <= 26) ? '@' + c[0] : '?';
+    bufferAppend(buf, "\x1b[7m", 4);
+    bufferAppend(buf, &sym, 1);
+    bufferAppend(buf, "\x1b[m", 3);
+    if(*currentColor != -1) {
+      char buffer[16];
+      int len = snprintf(buffer, sizeof(buffer), "\x1b[%dm", *currentColor);
+      bufferAppend(buf, buffer, len);
+    }
+  } else if(highlight == HL_NORMAL) {
+    if(*currentColor == 7) {
+      bufferAppend(buf, "\x1b[m", 3);
+      *currentColor = -1;
+    } else if(*currentColor != -1) {
+      bufferAppend(buf, "\x1b[39m", 5);
+      *currentColor = -1;
+    }
+    bufferAppend(buf, c, length);
+
+  } else {
+    int color = editorSyntaxToColor(highlight);
+    if (color != *currentColor) {
+      /*
+        * A selection is drawn in reverse video, which
+        * a color of its own does not turn off
+      */
+      if(*currentColor == 7) bufferAppend(buf, "\x1b[m", 3);
+      *currentColor = color;
+      char buffer[16];
+      int colorLength = snprintf(buffer, sizeof(buffer), "\x1b[%dm", color);
+      bufferAppend(buf, buffer, colorLength);
+    }
+    bufferAppend(buf, c, length);
+  }
+}
+
+/*
+  * Append a run of ASCII text in one color. Only control
+  * characters need to be drawn one at a time.
+*/
+void editorDrawRun(struct appendBuf* buf, char* s, int length,
+    unsigned char highlight, int* currentColor) {
+  int i = 0;
+  while(i < length) {
+    int end = i;
+    while(end < length && !iscntrl((unsigned char)s[end]) &&
+        !((unsigned char)s[end] & 0x80))
+      end++;
+    if(end > i) {
+      editorDrawChar(buf, &s[i], end - i, highlight, currentColor);
+      i = end;
+    }
+    if(i < length) {
+      editorDrawChar(buf, &s[i], 1, highlight, currentColor);
+      i++;
+    }
+  }
+}
+
+/*
+  * Draw rendered text that starts at `column`, leaving
+  * out what lies left of `colOff`. Columns no longer
+  * match bytes once multi-byte characters show up, so
+  * walk the code points. Return -1 once the text reaches
+  * `endColumn`, or the column it ends at.
+*/
+int editorDrawText(struct appendBuf* buf, char* render, int rsize,
+    struct spanWalker* walker, int column, int colOff, int endColumn,
+    int* currentColor) {
+  int i = 0;
+
+  while(i < rsize && column < colOff) {
+    int cp;
+    int length = editorDecodeUTF8(&render[i], rsize - i, &cp);
+    int width = editorCharWidth(cp);
     /*
-     * We should clear lines at one time instead of
-     * the entire screen
+      * A wide character cut in half by the left edge
     */
-    bufferAppend(buf, "\x1b[K", 3);
+    if(column + width > colOff) {
+      for(int pad = column + width - colOff; pad > 0; --pad)
+        bufferAppend(buf, " ", 1);
+    }
+    column += width;
+    i += length;
+  }
+
+  while(i < rsize) {
+    int cp;
+    int length = editorDecodeUTF8(&render[i], rsize - i, &cp);
+    int width = editorCharWidth(cp);
+    if(column + width > endColumn) return -1;
+    int runEnd;
+    unsigned char highlight = editorSpanAt(walker, i, &runEnd);
+    editorDrawChar(buf, &render[i], length, highlight, currentColor);
+    column += width;
+    i += length;
+  }
+  return column;
+}
+
+/*
+  * Draw a row holding multi-byte characters
+*/
+void editorDrawUTF8Row(struct appendBuf* buf, struct editorBuffer* buffer,
+    erow* row, int colOff, int screenCols) {
+  int currentColor = -1;
+  struct spanWalker walker;
+  editorSpanStart(&walker, buffer, row, -1, row->spans, row->numSpans);
+  editorDrawText(buf, row->render, row->rsize, &walker, 0, colOff,
+      colOff + screenCols, &currentColor);
+}
 
-    bufferAppend(buf, "\r\n", 2);
+/*
+  * Draw the visible part of a long row, rendering only
+  * the chunks that are on screen
+*/
+void editorDrawLongRow(struct appendBuf* buf, struct editorBuffer* buffer,
+    erow* row, int colOff, int screenCols) {
+  int currentColor = -1;
+  int first = editorChunkAtColumn(buffer, row, colOff);
+  int k = first;
+  for(; k < row->numChunks; ++k) {
+    struct rowChunk* chunk = editorRowChunk(buffer, row, k);
+    struct spanWalker walker;
+    editorSpanStart(&walker, buffer, row, k, chunk->spans, chunk->numSpans);
+    if(editorDrawText(buf, chunk->render, chunk->rsize, &walker,
+          chunk->rx, colOff, colOff + screenCols, &currentColor) == -1)
+      break;
+  }
+  editorTrimChunks(buffer, row, first, k);
+}
 
+/*
+  * Draw line `y` of a window
+*/
+void editorDrawRow(struct appendBuf* buf, struct editorView* view, int y) {
+  struct editorBuffer* buffer = view->buf;
+  int fileRow = y + view->rowOff;
+  int colOff = view->colOff;
+  if(view->wrap) {
+    int offset;
+    fileRow = editorWrapFind(&buffer->wrap, editorViewTopLine(view) + y,
+        &offset);
+    colOff = offset * view->screenCols;
+  }
+  if(fileRow >= buffer->numRows) {
+    if(buffer->numRows == 0 && E.numViews == 1 &&
+        y == view->screenRows / 3) {
+      char welcome[80];
+      int welcomeLength = snprintf(welcome, sizeof(welcome),
+          "Kilo editor -- version %s", KILO_VERSION);
+      if(welcomeLength > view->screenCols)
+        welcomeLength = view->screenCols;
+      int padding = (view->screenCols - welcomeLength) / 2;
+      if(padding) {
+        bufferAppend(buf, "~", 1);
+        padding--;
+      }
+      while(padding--)
+        bufferAppend(buf, " ", 1);
+      bufferAppend(buf, welcome, welcomeLength);
+    } else {
+      bufferAppend(buf, "~", 1);
+    }
+  } else {
+    erow* row = &buffer->row[fileRow];
+    editorRowThaw(buffer, row);
+    if(row->chunks) {
+      editorDrawLongRow(buf, buffer, row, colOff, view->screenCols);
+    } else if(row->ascii) {
+      int length = row->rsize - colOff;
+      if(length < 0) length = 0;
+      if (length > view->screenCols)
+        length = view->screenCols;
+      /*
+        * One color change per span at most
+      */
+      struct spanWalker walker;
+      editorSpanStart(&walker, buffer, row, -1, row->spans, row->numSpans);
+      int currentColor = -1;
+      int end = colOff + length;
+      for(int i = colOff; i < end;) {
+        int runEnd;
+        unsigned char highlight = editorSpanAt(&walker, i, &runEnd);
+        if(runEnd > end) runEnd = end;
+        editorDrawRun(buf, &row->render[i], runEnd - i, highlight,
+            &currentColor);
+        i = runEnd;
+      }
+    } else {
+      editorDrawUTF8Row(buf, buffer, row, colOff, view->screenCols);
+    }
+    if(view == E.view && view->numCursors && row->columns >= colOff &&
+        row->columns < colOff + view->screenCols &&
+        editorCursorAtEnd(view, row))
+      bufferAppend(buf, "\x1b[7m ", 5);
+    bufferAppend(buf, "\x1b[m", 3);
   }
+
+  /*
+   * We should clear lines at one time instead of
+   * the entire screen
+  */
+  bufferAppend(buf, "\x1b[K", 3);
 }
 
 /*
-  * To draw the status bar
+  * To draw the status bar of a window
 */
-void editorDrawStatusBar(struct appendBuf *buf) {
+void editorDrawStatusBar(struct appendBuf *buf, struct editorView* view) {
+  struct editorBuffer* buffer = view->buf;
   bufferAppend(buf, "\x1b[7m", 4);
-  char status[80];
+  char status[160];
   char rstatus[80];
-  int length = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-    E.filename ? E.filename : "[No Name]", E.numRows,
-    E.dirty ? "(modified)" : "");
+  char loading[32] = "";
+  if(stream.buf == buffer) {
+    char size[16];
+    snprintf(loading, sizeof(loading), "(loading %sB) ",
+        editorFormatSize(stream.bytes, size, sizeof(size)));
+  }
+  /*
+    * Words still being counted are shown as a lower
+    * bound
+  */
+  char bytes[16];
+  struct bufferStats* stats = &buffer->stats;
+  int length = snprintf(status, sizeof(status),
+    "%s%.20s - %d lines, %sB, %lld%s words %s%s",
+    E.numViews > 1 && view == E.view ? "* " : "",
+    buffer->filename ? buffer->filename : "[No Name]", buffer->numRows,
+    editorFormatSize(stats->bytes, bytes, sizeof(bytes)), stats->words,
+    stats->uncounted ? "+" : "", loading,
+    editorBufferModified(buffer) ? "(modified)" : "");
   int rlength = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-    E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numRows);
-  if(length > E.screenCols)
-    length = E.screenCols;
+    buffer->syntax ? buffer->syntax->filetype : "no ft", view->cy + 1,
+    buffer->numRows);
+  if(length > view->screenCols)
+    length = view->screenCols;
   bufferAppend(buf, status, length);
-  while(length < E.screenCols) {
-    if(E.screenCols - length == rlength) {
+  while(length < view->screenCols) {
+    if(view->screenCols - length == rlength) {
       bufferAppend(buf, rstatus, rlength);
       break;
     } else {
@@ -930,7 +7403,6 @@ void editorDrawStatusBar(struct appendBuf *buf) {
     }
   }
   bufferAppend(buf, "\x1b[m", 3);
-  bufferAppend(buf, "\r\n", 2);
 }
 
 /*
@@ -940,15 +7412,220 @@ void editorDrawMessageBar(struct appendBuf *buf) {
   bufferAppend(buf, "\x1b[K", 3);
   int length = strlen(E.statusMessage);
   if (length > E.screenCols) length = E.screenCols;
-  if (length && time(NULL) - E.statusMessageTime < 5)
+  if (length && editorElapsedMs(&E.statusMessageTime) < KILO_MESSAGE_MS)
     bufferAppend(buf, E.statusMessage, length);
 }
 
 /*
-  * To initialize the screen
+  * Send line `y` of the screen unless the terminal
+  * already shows it
+*/
+void editorSendLine(struct appendBuf* buf, int y, struct appendBuf* line) {
+  if(E.screenLines[y] && E.screenLengths[y] == line->length &&
+      !memcmp(E.screenLines[y], line->buf, line->length))
+    return;
+  char move[32];
+  int length = snprintf(move, sizeof(move), "\x1b[%d;1H", y + 1);
+  bufferAppend(buf, move, length);
+  bufferAppend(buf, line->buf, line->length);
+
+  E.screenLines[y] = realloc(E.screenLines[y], line->length + 1);
+  memcpy(E.screenLines[y], line->buf, line->length);
+  E.screenLengths[y] = line->length;
+}
+
+/*
+  * Whether a window shows other lines or columns than
+  * in the last frame
+*/
+int editorViewMoved(struct editorView* view) {
+  return view->drawnBuf != view->buf || view->drawnTop != view->top ||
+    view->drawnRows != view->screenRows || view->drawnCol != view->colOff ||
+    view->drawnLine != editorViewTopLine(view);
+}
+
+/*
+  * When a window shows the same buffer a few lines
+  * further up or down than in the last frame, have the
+  * terminal move the lines it already shows with a
+  * scroll region and delete or insert line, so only the
+  * lines that come into view have to be sent
+*/
+void editorScrollScreen(struct appendBuf* buf, struct editorView* view) {
+  int topLine = editorViewTopLine(view);
+  int delta = topLine - view->drawnLine;
+  int scrolled = E.scrollRegions && view->drawnBuf == view->buf &&
+    view->drawnTop == view->top && view->drawnRows == view->screenRows &&
+    delta != 0 && abs(delta) < view->screenRows;
+  view->drawnBuf = view->buf;
+  view->drawnLine = topLine;
+  view->drawnCol = view->colOff;
+  view->drawnTop = view->top;
+  view->drawnRows = view->screenRows;
+  if(!scrolled) return;
+
+  int top = view->top;
+  int bottom = view->top + view->screenRows - 1;
+  char command[64];
+  int length = snprintf(command, sizeof(command), "\x1b[m\x1b[%d;%dr\x1b[%d;1H"
+      "\x1b[%d%c\x1b[r", top + 1, bottom + 1, top + 1, abs(delta),
+      delta > 0 ? 'M' : 'L');
+  bufferAppend(buf, command, length);
+
+  /*
+    * Mirror the move in what we know of the screen
+  */
+  char** lines = &E.screenLines[top];
+  int* lengths = &E.screenLengths[top];
+  int rows = view->screenRows;
+  int n = abs(delta);
+  for(int y = 0; y < rows; ++y) {
+    int from = delta > 0 ? y : rows - 1 - y;
+    int to = delta > 0 ? from - n : from + n;
+    if(to < 0 || to >= rows) {
+      free(lines[from]);
+    } else {
+      lines[to] = lines[from];
+      lengths[to] = lengths[from];
+    }
+    lines[from] = NULL;
+  }
+}
+
+/*
+  * Forget what the terminal shows, so the next frame
+  * draws every line
+*/
+void editorInvalidateScreen() {
+  for(int y = 0; y <= E.screenRows; ++y) {
+    free(E.screenLines[y]);
+    E.screenLines[y] = NULL;
+  }
+}
+
+/*
+  * Mark parts of the screen as changed, to be drawn by
+  * the next frame
+*/
+void editorInvalidate(int parts) {
+  E.render.dirty |= parts;
+}
+
+/*
+  * Have `parts` of the screen drawn again once `ms`
+  * milliseconds have passed. With no free slot left the
+  * earliest deadline is taken as passed already.
+*/
+void editorPostDeadline(int ms, int parts) {
+  if(E.render.count == KILO_DEADLINES) {
+    int earliest = 0;
+    for(int i = 1; i < E.render.count; ++i) {
+      if(editorElapsedMs(&E.render.at[i]) >
+          editorElapsedMs(&E.render.at[earliest]))
+        earliest = i;
+    }
+    E.render.dirty |= E.render.parts[earliest];
+    E.render.at[earliest] = E.render.at[--E.render.count];
+    E.render.parts[earliest] = E.render.parts[E.render.count];
+  }
+  struct timespec* at = &E.render.at[E.render.count];
+  clock_gettime(CLOCK_MONOTONIC, at);
+  at->tv_sec += ms / 1000;
+  at->tv_nsec += (ms % 1000) * 1000000L;
+  if(at->tv_nsec >= 1000000000L) {
+    at->tv_sec++;
+    at->tv_nsec -= 1000000000L;
+  }
+  E.render.parts[E.render.count++] = parts;
+}
+
+/*
+  * Mark the parts of the deadlines that have passed
+*/
+void editorRunDeadlines() {
+  for(int i = 0; i < E.render.count; ) {
+    if(editorElapsedMs(&E.render.at[i]) < 0) {
+      i++;
+      continue;
+    }
+    E.render.dirty |= E.render.parts[i];
+    E.render.at[i] = E.render.at[--E.render.count];
+    E.render.parts[i] = E.render.parts[E.render.count];
+  }
+}
+
+/*
+  * Least time between frames, `--max-fps` or else
+  * `KILO_FRAME_MS`
+*/
+int editorFrameInterval() {
+  return E.frameInterval ? E.frameInterval : KILO_FRAME_MS;
+}
+
+/*
+  * Milliseconds the main loop may sleep, at most `limit`:
+  * until the next frame may be drawn when something is
+  * waiting to be, else until the next deadline
+*/
+int editorRenderTimeout(int limit) {
+  double timeout = limit;
+  if(E.render.dirty) {
+    double wait = editorFrameInterval() -
+      editorElapsedMs(&E.render.lastFrame);
+    if(wait < timeout) timeout = wait;
+  }
+  for(int i = 0; i < E.render.count; ++i) {
+    double wait = -editorElapsedMs(&E.render.at[i]);
+    if(wait < timeout) timeout = wait;
+  }
+  return timeout > 0 ? (int)timeout + 1 : 0;
+}
+
+void editorDrawScreen(int parts);
+
+/*
+  * Draw what changed, once the frame interval since the
+  * last frame has passed. Changes coming in faster are
+  * drawn together by a later frame.
+*/
+void editorRender() {
+  editorRunDeadlines();
+  if(!E.render.dirty) return;
+  if(editorElapsedMs(&E.render.lastFrame) < editorFrameInterval()) return;
+  editorDrawScreen(E.render.dirty);
+}
+
+/*
+  * To initialize the screen
+*/
+void editorRefreshScreen() {
+  editorDrawScreen(DIRTY_ALL);
+}
+
+/*
+  * Draw the parts of the screen in `parts`. Lines that
+  * still show the same are not sent either way.
 */
-void editorRefreshScreen() {
-  editorScroll();
+void editorDrawScreen(int parts) {
+  if(macro.replaying) return;
+  E.render.dirty = 0;
+  clock_gettime(CLOCK_MONOTONIC, &E.render.lastFrame);
+  /*
+    * A moved cursor only marks the status bar. The text
+    * is drawn too when following the cursor scrolled a
+    * window or moved the bracket shown as matching.
+  */
+  for(int i = 0; i < E.numViews; ++i) {
+    editorScroll(E.views[i]);
+    if(editorViewMoved(E.views[i])) parts |= DIRTY_TEXT;
+  }
+  struct editorBuffer* bracketBuf = E.bracket.buf;
+  int bracketRow = E.bracket.row;
+  int bracketStart = E.bracket.start;
+  editorUpdateBracketMatch();
+  if(E.bracket.buf != bracketBuf || (bracketBuf &&
+        (E.bracket.row != bracketRow || E.bracket.start != bracketStart)))
+    parts |= DIRTY_TEXT;
 
   struct appendBuf buf = ABUF_INIT;
   /*
@@ -966,16 +7643,49 @@ void editorRefreshScreen() {
     followed by a `[` character.
   */
 
-  // Move cursor position
-  bufferAppend(&buf, "\x1b[H",3);
-
-  editorDrawRows(&buf);
-  editorDrawStatusBar(&buf);
-  editorDrawMessageBar(&buf);
+  if(E.syncOutput) bufferAppend(&buf, "\x1b[?2026h", 8);
 
+  /*
+    * Lines are drawn into `line` and only sent when
+    * they differ from what the terminal shows
+  */
+  struct appendBuf line = ABUF_INIT;
+  for(int i = 0; i < E.numViews; ++i) {
+    struct editorView* view = E.views[i];
+    if(parts & DIRTY_TEXT) {
+      editorScrollScreen(&buf, view);
+      for(int y = 0; y < view->screenRows; ++y) {
+        line.length = 0;
+        editorDrawRow(&line, view, y);
+        editorSendLine(&buf, view->top + y, &line);
+      }
+    }
+    if(parts & DIRTY_STATUS) {
+      line.length = 0;
+      editorDrawStatusBar(&line, view);
+      editorSendLine(&buf, view->top + view->screenRows, &line);
+    }
+  }
+  if(parts & DIRTY_MESSAGE) {
+    line.length = 0;
+    editorDrawMessageBar(&line);
+    editorSendLine(&buf, E.screenRows, &line);
+  }
+  bufferFree(&line);
+
+  struct editorView* view = E.view;
+  int cursorY = view->cy - view->rowOff;
+  int cursorX = view->rx - view->colOff;
+  if(view->wrap) {
+    int line = editorWrapCursorLine(view);
+    cursorY = editorWrapLine(&view->buf->wrap, view->cy) + line -
+      editorViewTopLine(view);
+    cursorX = view->rx - line * view->screenCols;
+    if(cursorX >= view->screenCols) cursorX = view->screenCols - 1;
+  }
   char buffer[32];
   snprintf(buffer, sizeof(buffer), "\x1b[%d;%dH",
-    (E.cy - E.rowOff) + 1, (E.rx -E.colOff) + 1);
+    view->top + cursorY + 1, cursorX + 1);
 
   bufferAppend(&buf, buffer, strlen(buffer));
 
@@ -984,6 +7694,7 @@ void editorRefreshScreen() {
   */
   // bufferAppend(&buf, "\x1b[H", 3);
   bufferAppend(&buf, "\x1b[?25h", 6);
+  if(E.syncOutput) bufferAppend(&buf, "\x1b[?2026l", 8);
 
   write(STDOUT_FILENO, buf.buf, buf.length);
   bufferFree(&buf);
@@ -998,13 +7709,16 @@ void editorSetStatusMessage(const char* fmt, ...) {
   vsnprintf(E.statusMessage,
     sizeof(E.statusMessage), fmt, ap);
   va_end(ap);
-  E.statusMessageTime = time(NULL);
+  clock_gettime(CLOCK_MONOTONIC, &E.statusMessageTime);
+  editorInvalidate(DIRTY_MESSAGE);
+  editorPostDeadline(KILO_MESSAGE_MS, DIRTY_MESSAGE);
 }
 
 /*
  * Use prompt and return the value of the user input
 */
-char* editorPrompt(char* prompt, void(*callback)(char*, int)) {
+char* editorPromptInput(char* prompt, void(*callback)(char*, int),
+    int allowEmpty) {
   size_t bufSize = 128;
   char* buf = malloc(bufSize);
 
@@ -1025,7 +7739,7 @@ char* editorPrompt(char* prompt, void(*callback)(char*, int)) {
       free(buf);
       return NULL;
     } else if(c == '\r') {
-      if(bufLength != 0) {
+      if(bufLength != 0 || allowEmpty) {
         editorSetStatusMessage("");
         if(callback) callback(buf, c);
         return buf;
@@ -1042,47 +7756,649 @@ char* editorPrompt(char* prompt, void(*callback)(char*, int)) {
   }
 }
 
+char* editorPrompt(char* prompt, void(*callback)(char*, int)) {
+  return editorPromptInput(prompt, callback, 0);
+}
+
+/*
+  * Ask a question answered by one of the keys in
+  * `answers`. Return the key, or 0 for ESC.
+*/
+int editorAsk(char* question, const char* answers) {
+  int answer = 0;
+  while(1) {
+    editorSetStatusMessage("%s", question);
+    editorRefreshScreen();
+    int c = editorReadKey();
+    if(c == '\x1b') break;
+    if(c > 0 && c < 128 && strchr(answers, tolower(c))) {
+      answer = tolower(c);
+      break;
+    }
+  }
+  editorSetStatusMessage("");
+  return answer;
+}
+
 /*
  * To process the w s a d
 */
 void editorMoveCursor(int key) {
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
 
-  erow* row = (E.cy >= E.numRows) ? NULL : &E.row[E.cy];
+  erow* row = (view->cy >= buf->numRows) ? NULL : &buf->row[view->cy];
+  if(row) editorRowThaw(buf, row);
 
   switch (key) {
     case ARROW_LEFT:
-      if(E.cx != 0) {
-        E.cx--;
-      } else if(E.cy > 0) {
-        E.cy--;
-        E.cx = E.row[E.cy].size;
+      if(view->cx != 0) {
+        view->cx--;
+        while(view->cx > 0 && editorIsContinuationByte(row->chars[view->cx]))
+          view->cx--;
+      } else if(view->cy > 0) {
+        view->cy--;
+        view->cx = buf->row[view->cy].size;
       }
       break;
     case ARROW_RIGHT:
-      if(row && E.cx < row->size) {
-        E.cx++;
-      } else if(row && E.cx == row->size) {
-        E.cy++;
-        E.cx = 0;
+      if(row && view->cx < row->size) {
+        view->cx++;
+        while(view->cx < row->size &&
+            editorIsContinuationByte(row->chars[view->cx]))
+          view->cx++;
+      } else if(row && view->cx == row->size) {
+        view->cy++;
+        view->cx = 0;
       }
       break;
     case ARROW_UP:
-      if(E.cy != 0) {
-        E.cy--;
+      if(view->cy != 0) {
+        view->cy--;
       }
       break;
     case ARROW_DOWN:
-      if(E.cy < E.numRows) {
-        E.cy++;
+      if(view->cy < buf->numRows) {
+        view->cy++;
       }
       break;
   }
 
-  row = (E.cy >= E.numRows) ? NULL : &E.row[E.cy];
+  row = (view->cy >= buf->numRows) ? NULL : &buf->row[view->cy];
+  if(row) editorRowThaw(buf, row);
   int rowLength = row ? row->size : 0;
-  if(E.cx > rowLength) {
-    E.cx = rowLength;
+  if(view->cx > rowLength) {
+    view->cx = rowLength;
+  }
+  while(row && view->cx > 0 && editorIsContinuationByte(row->chars[view->cx]))
+    view->cx--;
+}
+
+/*
+  * Project search. Files under the working directory
+  * are searched by a pool of threads, each with a deque
+  * of paths of its own. A thread takes the newest path
+  * from its own deque, so it goes depth first through
+  * the tree, and takes the oldest from another thread's
+  * deque once its own runs dry.
+*/
+struct grepDeque {
+  pthread_mutex_t lock;
+  char** paths;
+  int head;
+  int tail;
+  int capacity;
+};
+
+struct grepHit {
+  char* path;
+  int line;
+  int column;
+  char* text;
+};
+
+struct grepPool {
+  const char* query;
+  int queryLength;
+  int numWorkers;
+  struct grepDeque deques[KILO_MAX_WORKERS];
+  pthread_t threads[KILO_MAX_WORKERS];
+  /*
+    * Paths queued or being searched. The scan is over
+    * once it drops to zero.
+  */
+  pthread_mutex_t lock;
+  int pending;
+  int cancelled;
+  /*
+    * Idle workers sleep on `wake`, which is signaled
+    * each time a path is queued and broadcast once the
+    * scan is over or cancelled. `pushes` counts the
+    * paths queued, so a worker that found every deque
+    * empty can tell whether one came in since.
+  */
+  pthread_cond_t wake;
+  unsigned int pushes;
+  int files;
+  /*
+    * Hits are added while the picker reads them, both
+    * under `lock`
+  */
+  struct grepHit* hits;
+  int numHits;
+  int hitCapacity;
+};
+
+struct grepWorker {
+  struct grepPool* pool;
+  int id;
+};
+
+void editorGrepPush(struct grepPool* pool, int worker, char* path) {
+  struct grepDeque* deque = &pool->deques[worker];
+  pthread_mutex_lock(&pool->lock);
+  pool->pending++;
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_mutex_lock(&deque->lock);
+  if(deque->tail == deque->capacity) {
+    memmove(deque->paths, &deque->paths[deque->head],
+        sizeof(char*) * (deque->tail - deque->head));
+    deque->tail -= deque->head;
+    deque->head = 0;
+    if(deque->tail * 2 >= deque->capacity) {
+      deque->capacity = deque->capacity ? deque->capacity * 2 : 64;
+      deque->paths = realloc(deque->paths, sizeof(char*) * deque->capacity);
+    }
+  }
+  deque->paths[deque->tail++] = path;
+  pthread_mutex_unlock(&deque->lock);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->pushes++;
+  pthread_cond_signal(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+  * Take a path from our own deque, or steal one
+*/
+char* editorGrepTake(struct grepPool* pool, int worker) {
+  struct grepDeque* deque = &pool->deques[worker];
+  char* path = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if(deque->tail > deque->head) path = deque->paths[--deque->tail];
+  pthread_mutex_unlock(&deque->lock);
+
+  for(int i = 1; path == NULL && i < pool->numWorkers; ++i) {
+    struct grepDeque* victim = &pool->deques[(worker + i) % pool->numWorkers];
+    pthread_mutex_lock(&victim->lock);
+    if(victim->tail > victim->head) path = victim->paths[victim->head++];
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return path;
+}
+
+void editorGrepAddHit(struct grepPool* pool, const char* path, int line,
+    int column, const char* text, int length) {
+  if(length > 256) length = 256;
+  pthread_mutex_lock(&pool->lock);
+  if(pool->numHits < KILO_GREP_MAX_HITS) {
+    if(pool->numHits == pool->hitCapacity) {
+      pool->hitCapacity = pool->hitCapacity ? pool->hitCapacity * 2 : 256;
+      pool->hits = realloc(pool->hits,
+          sizeof(struct grepHit) * pool->hitCapacity);
+    }
+    struct grepHit* hit = &pool->hits[pool->numHits++];
+    hit->path = strdup(path);
+    hit->line = line;
+    hit->column = column;
+    hit->text = malloc(length + 1);
+    memcpy(hit->text, text, length);
+    hit->text[length] = '\0';
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+  * Search a mapped file the way `editorFind` searches
+  * rows, reporting the first match of every line.
+  * Files with a NUL near the start are taken to be
+  * binary and skipped.
+*/
+void editorGrepFile(struct grepPool* pool, const char* path) {
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) return;
+  struct stat st;
+  if(fstat(fd, &st) == -1 || st.st_size == 0 || st.st_size > INT_MAX) {
+    close(fd);
+    return;
+  }
+  size_t size = st.st_size;
+  char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) return;
+
+  if(memchr(data, '\0', size < 8000 ? size : 8000) == NULL) {
+    int line = 1;
+    const char* lineStart = data;
+    const char* p = data;
+    const char* last = data + size;
+    while((p = memmem(p, last - p, pool->query, pool->queryLength))) {
+      const char* newline;
+      while((newline = memchr(lineStart, '\n', p - lineStart))) {
+        line++;
+        lineStart = newline + 1;
+      }
+      const char* lineEnd = memchr(p, '\n', last - p);
+      if(lineEnd == NULL) lineEnd = last;
+      editorGrepAddHit(pool, path, line, p - lineStart, lineStart,
+          lineEnd - lineStart);
+      if(lineEnd == last) break;
+      p = lineEnd + 1;
+      lineStart = p;
+      line++;
+    }
+  }
+  munmap(data, size);
+}
+
+/*
+  * Queue the entries of a directory. Hidden entries are
+  * left out, and so are links to directories, which
+  * could lead round in circles.
+*/
+void editorGrepDirectory(struct grepPool* pool, int worker,
+    const char* path) {
+  DIR* dir = opendir(path);
+  if(dir == NULL) return;
+  struct dirent* entry;
+  while((entry = readdir(dir))) {
+    if(entry->d_name[0] == '.') continue;
+    char* child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+    if(!strcmp(path, ".")) strcpy(child, entry->d_name);
+    else sprintf(child, "%s/%s", path, entry->d_name);
+
+    int type = entry->d_type;
+    if(type == DT_UNKNOWN || type == DT_LNK) {
+      struct stat st;
+      if(stat(child, &st) == -1) type = DT_UNKNOWN;
+      else if(S_ISREG(st.st_mode)) type = DT_REG;
+      else if(S_ISDIR(st.st_mode) && entry->d_type != DT_LNK) type = DT_DIR;
+      else type = DT_UNKNOWN;
+    }
+    if(type == DT_REG || type == DT_DIR) editorGrepPush(pool, worker, child);
+    else free(child);
+  }
+  closedir(dir);
+}
+
+void* editorGrepRun(void* arg) {
+  struct grepWorker* self = arg;
+  struct grepPool* pool = self->pool;
+  while(1) {
+    pthread_mutex_lock(&pool->lock);
+    unsigned int pushes = pool->pushes;
+    pthread_mutex_unlock(&pool->lock);
+
+    char* path = editorGrepTake(pool, self->id);
+    if(path == NULL) {
+      pthread_mutex_lock(&pool->lock);
+      while(pool->pushes == pushes && pool->pending > 0 && !pool->cancelled)
+        pthread_cond_wait(&pool->wake, &pool->lock);
+      int done = pool->pending == 0 || pool->cancelled;
+      pthread_mutex_unlock(&pool->lock);
+      if(done) break;
+      continue;
+    }
+
+    struct stat st;
+    int cancelled;
+    pthread_mutex_lock(&pool->lock);
+    cancelled = pool->cancelled;
+    pthread_mutex_unlock(&pool->lock);
+    if(!cancelled && stat(path, &st) == 0) {
+      if(S_ISDIR(st.st_mode)) {
+        editorGrepDirectory(pool, self->id, path);
+      } else {
+        editorGrepFile(pool, path);
+        pthread_mutex_lock(&pool->lock);
+        pool->files++;
+        pthread_mutex_unlock(&pool->lock);
+      }
+    }
+    free(path);
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->pending == 0) pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return NULL;
+}
+
+/*
+  * Whether the scan is still going, and the number of
+  * hits and files searched so far
+*/
+int editorGrepProgress(struct grepPool* pool, int* hits, int* files) {
+  pthread_mutex_lock(&pool->lock);
+  int running = pool->pending > 0;
+  *hits = pool->numHits;
+  *files = pool->files;
+  pthread_mutex_unlock(&pool->lock);
+  return running;
+}
+
+void editorGrepStop(struct grepPool* pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->cancelled = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for(int i = 0; i < pool->numWorkers; ++i) {
+    pthread_join(pool->threads[i], NULL);
+    struct grepDeque* deque = &pool->deques[i];
+    for(int j = deque->head; j < deque->tail; ++j) free(deque->paths[j]);
+    free(deque->paths);
+    pthread_mutex_destroy(&deque->lock);
+  }
+  for(int i = 0; i < pool->numHits; ++i) {
+    free(pool->hits[i].path);
+    free(pool->hits[i].text);
+  }
+  free(pool->hits);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/*
+  * Draw the hits from `offset` on over the text area,
+  * with the selected one in reverse video
+*/
+void editorGrepDraw(struct grepPool* pool, int offset, int selected,
+    const char* status) {
+  struct appendBuf buf = ABUF_INIT;
+  struct appendBuf line = ABUF_INIT;
+  bufferAppend(&buf, "\x1b[?25l", 6);
+
+  pthread_mutex_lock(&pool->lock);
+  for(int y = 0; y < E.screenRows; ++y) {
+    line.length = 0;
+    int index = offset + y;
+    if(index < pool->numHits) {
+      struct grepHit* hit = &pool->hits[index];
+      char entry[512];
+      int length = snprintf(entry, sizeof(entry), "%s:%d: %s", hit->path,
+          hit->line, hit->text);
+      if(length >= (int)sizeof(entry)) length = sizeof(entry) - 1;
+      if(length > E.screenCols) length = E.screenCols;
+      for(int i = 0; i < length; ++i) {
+        if(entry[i] == '\t' || iscntrl((unsigned char)entry[i]))
+          entry[i] = ' ';
+      }
+      if(index == selected) bufferAppend(&line, "\x1b[7m", 4);
+      bufferAppend(&line, entry, length);
+      if(index == selected) bufferAppend(&line, "\x1b[m", 3);
+    }
+    bufferAppend(&line, "\x1b[K", 3);
+    editorSendLine(&buf, y, &line);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  line.length = 0;
+  bufferAppend(&line, "\x1b[K", 3);
+  bufferAppend(&line, status, strlen(status) < (size_t)E.screenCols ?
+      (int)strlen(status) : E.screenCols);
+  editorSendLine(&buf, E.screenRows, &line);
+  bufferFree(&line);
+
+  write(STDOUT_FILENO, buf.buf, buf.length);
+  bufferFree(&buf);
+}
+
+/*
+  * Search every file under the working directory and
+  * list the hits as they come in. Enter opens the
+  * selected hit at its line, ESC goes back.
+*/
+void editorGrep() {
+  char* query = editorPrompt("Grep: %s (ESC to cancel)", NULL);
+  if(query == NULL) return;
+
+  struct grepPool pool;
+  memset(&pool, 0, sizeof(pool));
+  pool.query = query;
+  pool.queryLength = strlen(query);
+  pool.numWorkers = editorWorkerCount(KILO_MAX_WORKERS, 1);
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.wake, NULL);
+  for(int i = 0; i < pool.numWorkers; ++i)
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+  editorGrepPush(&pool, 0, strdup("."));
+
+  struct grepWorker workers[KILO_MAX_WORKERS];
+  for(int i = 0; i < pool.numWorkers; ++i) {
+    workers[i].pool = &pool;
+    workers[i].id = i;
+    if(pthread_create(&pool.threads[i], NULL, editorGrepRun,
+          &workers[i]) != 0)
+      die("pthread_create");
+  }
+
+  int selected = 0;
+  int offset = 0;
+  int chosen = -1;
+  while(1) {
+    int hits;
+    int files;
+    int running = editorGrepProgress(&pool, &hits, &files);
+    char status[80];
+    snprintf(status, sizeof(status), "Grep %.30s: %d hits in %d files%s",
+        query, hits, files, running ? " (searching)" : "");
+
+    if(selected >= hits) selected = hits ? hits - 1 : 0;
+    if(selected < offset) offset = selected;
+    if(selected >= offset + E.screenRows) offset = selected - E.screenRows + 1;
+    editorGrepDraw(&pool, offset, selected, status);
+
+    if(!editorInputPending(running ? 50 : -1)) continue;
+    int c = editorReadKey();
+    if(c == '\x1b' || c == CTRL_KEY('q')) break;
+    if(c == '\r' && hits > 0) {
+      chosen = selected;
+      break;
+    }
+    if(c == ARROW_UP && selected > 0) selected--;
+    if(c == ARROW_DOWN) selected++;
+    if(c == PAGE_UP) selected = selected > E.screenRows ?
+      selected - E.screenRows : 0;
+    if(c == PAGE_DOWN) selected += E.screenRows;
+  }
+
+  char* path = NULL;
+  int line = 0;
+  int column = 0;
+  if(chosen != -1) {
+    pthread_mutex_lock(&pool.lock);
+    path = strdup(pool.hits[chosen].path);
+    line = pool.hits[chosen].line;
+    column = pool.hits[chosen].column;
+    pthread_mutex_unlock(&pool.lock);
+  }
+  editorGrepStop(&pool);
+  free(query);
+
+  if(path) {
+    struct editorBuffer* buf = editorVisitFile(path);
+    if(buf) {
+      E.view->cy = line - 1 < buf->numRows ? line - 1 : buf->numRows;
+      E.view->cx = column;
+      E.view->rowOff = buf->numRows;
+    }
+    free(path);
+  }
+  editorSetStatusMessage("");
+}
+
+void editorStartMacro() {
+  macro.length = 0;
+  macro.recording = 1;
+  editorSetStatusMessage("Recording macro, C-x ) to stop");
+}
+
+void editorStopMacro() {
+  if(!macro.recording) return;
+  /*
+    * Leave out the `C-x )` that stopped it
+  */
+  macro.length -= 2;
+  macro.recording = 0;
+  editorSetStatusMessage("Recorded %d keys", macro.length);
+}
+
+/*
+  * Play the macro back `times` times, or with 0 until
+  * the cursor reaches the end of the buffer or a run
+  * leaves it no further down. Nothing is drawn and no
+  * row highlighted until the last run is over, so a
+  * replay goes as fast as the edits themselves.
+*/
+void editorReplayMacro(int times) {
+  if(macro.recording) {
+    macro.length -= 2;
+    editorSetStatusMessage("Stop recording with C-x ) first");
+    return;
+  }
+  if(macro.length == 0) {
+    editorSetStatusMessage("No macro recorded");
+    return;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  macro.replaying = 1;
+  macro.exhausted = 0;
+  int runs = 0;
+  while(times == 0 || runs < times) {
+    int before = E.view->cy;
+    macro.position = 0;
+    while(macro.position < macro.length && !macro.exhausted)
+      editorProcessKeypress();
+    runs++;
+    if(macro.exhausted) break;
+    if(times == 0 && (E.view->cy >= E.view->buf->numRows ||
+          E.view->cy <= before))
+      break;
+  }
+  macro.replaying = 0;
+
+  for(int i = 0; i < E.numBuffers; ++i)
+    editorFlushHighlight(E.buffers[i]);
+  editorSetStatusMessage("Replayed macro %d times in %.1f ms%s", runs,
+      editorElapsedMs(&start), macro.exhausted ? ", stopped in a prompt" : "");
+}
+
+void editorReplayMacroTimes() {
+  if(macro.recording) {
+    editorReplayMacro(1);
+    return;
+  }
+  char* answer = editorPrompt("Replay how many times: %s "
+      "(0 to the end, ESC to cancel)", NULL);
+  if(answer == NULL) return;
+  int times = atoi(answer);
+  free(answer);
+  if(times >= 0) editorReplayMacro(times);
+}
+
+/*
+  * Handle the key following `Ctrl-X`, which leads
+  * the window and buffer commands
+*/
+void editorProcessWindowKey() {
+  editorSetStatusMessage("C-x: 2 split | o other | 0 close | 1 only | "
+      "C-f open | b buffer | k kill | g grep | [ block | w wrap | i input | "
+      "m memory | SPACE mark | c column | y yank pop | ( ) macro | "
+      "e E replay | s sort | u uniq | f v filter");
+  editorRefreshScreen();
+  int c = editorReadKey();
+  editorSetStatusMessage("");
+
+  switch(c) {
+    case '2':
+      editorSplitView();
+      break;
+    case 'o':
+      editorSelectView((E.currentView + 1) % E.numViews);
+      break;
+    case '0':
+      editorCloseView();
+      break;
+    case '1':
+      editorCloseOtherViews();
+      break;
+    case CTRL_KEY('f'):
+      editorOpenFile();
+      break;
+    case 'b':
+      editorNextBuffer();
+      break;
+    case 'k':
+      editorKillBuffer();
+      break;
+    case 'g':
+      editorGrep();
+      break;
+    case '[':
+      editorJumpToBlockStart();
+      break;
+    case 'w':
+      editorToggleWrap();
+      break;
+    case 'm':
+      editorShowMemory();
+      break;
+    case ' ':
+      editorSetMark();
+      break;
+    case 'c':
+      editorColumnCursors();
+      break;
+    case 'y':
+      editorYankPop();
+      break;
+    case 's':
+      editorSortLines();
+      break;
+    case 'u':
+      editorUniqLines();
+      break;
+    case 'f':
+      editorFilterLines(0);
+      break;
+    case 'v':
+      editorFilterLines(1);
+      break;
+    case '(':
+      editorStartMacro();
+      break;
+    case ')':
+      editorStopMacro();
+      break;
+    case 'e':
+      editorReplayMacro(1);
+      break;
+    case 'E':
+      editorReplayMacroTimes();
+      break;
+    case 'i':
+      editorSetStatusMessage("Input: %d keys last frame, %d at most, "
+          "%lu frames", E.inputDepth, E.inputPeak, E.frames);
+      break;
   }
+  /*
+    * Windows may have been split, closed or given
+    * another buffer
+  */
+  editorInvalidate(DIRTY_ALL);
 }
 
 /*
@@ -1092,17 +8408,33 @@ void editorProcessKeypress() {
   static int quitTimes = KILO_QUIT_TIMES;
   int c = editorReadKey();
 
+  struct editorView* view = E.view;
+  struct editorBuffer* buf = view->buf;
+  int cx = view->cx;
+  int cy = view->cy;
+  int markSet = view->markSet;
+
+  if(view->numCursors && editorMultiKey(view, c)) {
+    editorInvalidate(DIRTY_TEXT | DIRTY_STATUS);
+    quitTimes = KILO_QUIT_TIMES;
+    return;
+  }
+
   switch(c) {
     case '\r':
       editorInsertNewline();
       break;
 
-    case CTRL_KEY('q'):
-      if(E.dirty && quitTimes > 0) {
-        editorSetStatusMessage("WARNING!!! File has unsaved changes."
-            "Press Ctrl-Q %d more times to quit.", quitTimes);
-        quitTimes--;
-        return;
+    case CTRL_KEY('q'): {
+        int modified = 0;
+        for(int i = 0; i < E.numBuffers; ++i)
+          modified += editorBufferModified(E.buffers[i]);
+        if(modified && quitTimes > 0) {
+          editorSetStatusMessage("WARNING!!! File has unsaved changes."
+              "Press Ctrl-Q %d more times to quit.", quitTimes);
+          quitTimes--;
+          return;
+        }
       }
       write(STDOUT_FILENO, "\x1b[2J",4);
       write(STDOUT_FILENO, "\x1b[H",3);
@@ -1110,22 +8442,51 @@ void editorProcessKeypress() {
       break;
 
     case CTRL_KEY('s'):
-      editorSave();
+      editorSave(buf);
+      break;
+
+    case CTRL_KEY('x'):
+      editorProcessWindowKey();
       break;
 
     case HOME_KEY:
-      E.cx = 0;
+      view->cx = 0;
       break;
 
     case END_KEY:
-      if(E.cy < E.numRows)
-        E.cx = E.row[E.cy].size;
+      if(view->cy < buf->numRows)
+        view->cx = buf->row[view->cy].size;
       break;
 
     case CTRL_KEY('f'):
       editorFind();
       break;
 
+    case CTRL_KEY('r'):
+      editorReplaceAll();
+      break;
+
+    case CTRL_KEY('n'):
+      editorComplete();
+      break;
+
+    case CTRL_KEY(']'):
+      editorJumpToMatch();
+      break;
+
+    case CTRL_KEY('@'):
+      editorSetMark();
+      break;
+
+    case CTRL_KEY('w'):
+    case CTRL_KEY('k'):
+      editorKillRegion(c == CTRL_KEY('w'));
+      break;
+
+    case CTRL_KEY('y'):
+      editorYank(killRing.latest);
+      break;
+
     case BACKSPACE:
     case CTRL_KEY('h'):
     case DEL_KEY:
@@ -1136,15 +8497,19 @@ void editorProcessKeypress() {
 
     case PAGE_UP:
     case PAGE_DOWN: {
+        if(view->wrap) {
+          editorPageWrapped(view, c == PAGE_UP ? -1 : 1);
+          break;
+        }
         if (c == PAGE_UP) {
-          E.cy = E.rowOff;
+          view->cy = view->rowOff;
         } else if(c == PAGE_DOWN) {
-          E.cy = E.rowOff + E.screenRows - 1;
-          if(E.cy > E.numRows)
-            E.cy = E.numRows;
+          view->cy = view->rowOff + view->screenRows - 1;
+          if(view->cy > buf->numRows)
+            view->cy = buf->numRows;
         }
 
-        int times = E.screenRows;
+        int times = view->screenRows;
         while(times--)
           editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
       }
@@ -1157,8 +8522,11 @@ void editorProcessKeypress() {
       editorMoveCursor(c);
       break;
 
-    case CTRL_KEY('l'):
     case '\x1b':
+      view->markSet = 0;
+      break;
+
+    case CTRL_KEY('l'):
       break;
 
     default:
@@ -1166,39 +8534,227 @@ void editorProcessKeypress() {
       break;
   }
 
+  /*
+    * Edits mark what they changed themselves. The cursor
+    * shows in the status bar, and in the text while the
+    * mark selects a region.
+  */
+  if(E.view != view || view->buf != buf) {
+    editorInvalidate(DIRTY_ALL);
+  } else if(view->cx != cx || view->cy != cy || view->markSet != markSet) {
+    editorInvalidate(view->markSet || markSet ?
+        DIRTY_TEXT | DIRTY_STATUS : DIRTY_STATUS);
+  }
   quitTimes = KILO_QUIT_TIMES;
 }
 
+/*
+  * Look for files of open buffers that other programs
+  * changed, at most once every `KILO_DISK_CHECK_MS`.
+  * Noticing costs a `stat` per buffer. A changed file is
+  * mapped and its groups of rows hashed from both ends
+  * until one differs, and only the rows in between are
+  * read again. Return 1 when the screen needs drawing.
+*/
+int editorCheckDisk() {
+  static struct timespec last;
+  if(last.tv_sec && editorElapsedMs(&last) < KILO_DISK_CHECK_MS) return 0;
+  clock_gettime(CLOCK_MONOTONIC, &last);
+  int changed = 0;
+  for(int i = 0; i < E.numBuffers; ++i)
+    changed |= editorCheckBuffer(E.buffers[i]);
+  return changed;
+}
+
+/*
+  * Apply every key that is already waiting before the
+  * next frame is drawn, so the screen does not fall
+  * behind when keys come in faster than frames can be
+  * drawn. Under a frame rate cap, keys arriving before
+  * the next frame is due are taken in as well. A frame
+  * is drawn at least every `KILO_INPUT_LATENCY`
+  * milliseconds however long the input goes on.
+*/
+void editorProcessInput() {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int keys = 0;
+  while(1) {
+    editorProcessKeypress();
+    keys++;
+    double elapsed = editorElapsedMs(&start);
+    if(elapsed >= KILO_INPUT_LATENCY) break;
+    int wait = E.frameInterval - (int)elapsed;
+    if(!editorInputPending(wait > 0 ? wait : 0)) break;
+  }
+  E.inputDepth = keys;
+  if(keys > E.inputPeak) E.inputPeak = keys;
+  E.frames++;
+}
+
+/*
+  * Ask the terminal whether it knows synchronized
+  * output, mode 2026. The query is followed by a
+  * request for the device attributes, which every
+  * terminal answers, so one that ignores the first
+  * query is not waited on. Scroll regions are used
+  * unless the terminal says it is dumb.
+*/
+void editorDetectTerminal() {
+  const char* term = getenv("TERM");
+  E.scrollRegions = term && strcmp(term, "dumb") != 0;
+  E.syncOutput = 0;
+
+  const char* query = "\x1b[?2026$p\x1b[c";
+  if(write(STDOUT_FILENO, query, strlen(query)) != (ssize_t)strlen(query))
+    return;
+  char reply[128];
+  unsigned int length = 0;
+  while(length < sizeof(reply) - 1) {
+    if(read(STDIN_FILENO, &reply[length], 1) != 1) break;
+    if(reply[length++] == 'c') break;
+  }
+  reply[length] = '\0';
+
+  /*
+    * The reply is `ESC [ ? 2026 ; Ps $ y`, where 1 or 2
+    * mean the mode is known and 0 that it is not
+  */
+  char* mode = strstr(reply, "\x1b[?2026;");
+  if(mode && (mode[8] == '1' || mode[8] == '2')) E.syncOutput = 1;
+}
+
 void initEditor() {
-  E.cx = 0;
-  E.cy = 0;
-  E.rx = 0;
-  E.rowOff = 0;
-  E.colOff = 0;
-  E.numRows = 0;
-  E.row = NULL;
-  E.dirty = 0;
-  E.filename = NULL;
+  E.views = NULL;
+  E.numViews = 0;
+  E.buffers = NULL;
+  E.numBuffers = 0;
   E.statusMessage[0] = '\0';
-  E.statusMessageTime = 0;
-  E.syntax = NULL;
+  E.statusMessageTime.tv_sec = 0;
+  E.statusMessageTime.tv_nsec = 0;
+  E.render.dirty = DIRTY_ALL;
+  E.render.count = 0;
 
   if(getWindowSize(&E.screenRows, &E.screenCols) == -1)
     die("getWindowSize");
 
-  E.screenRows -= 2;
+  E.screenRows -= 1;
+  E.screenLines = calloc(E.screenRows + 1, sizeof(char*));
+  E.screenLengths = calloc(E.screenRows + 1, sizeof(int));
+  editorDetectTerminal();
+
+  editorNewView(editorNewBuffer(), 0);
+  editorSelectView(0);
+}
+
+/*
+  * Time loading a file and the scans that walk the
+  * whole buffer, then print their throughput. Reached
+  * with `--bench-scan FILE`, for comparing changes to
+  * the way rows are laid out in memory.
+*/
+void editorBenchScan(char* filename) {
+  struct editorBuffer* buf = editorNewBuffer();
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(editorOpen(buf, filename) == -1) die("fopen");
+  double openMs = editorElapsedMs(&start);
+
+  double megabytes = 0;
+  for(int i = 0; i < buf->numRows; ++i)
+    megabytes += buf->row[i].size + 1;
+  megabytes /= 1024 * 1024;
+
+  const int rounds = 20;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int r = 0; r < rounds; ++r) {
+    int length;
+    free(editorRowsToString(buf, &length));
+  }
+  double joinMs = editorElapsedMs(&start) / rounds;
+
+  /*
+    * The search replace-all runs, on a single thread
+  */
+  long matches = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int r = 0; r < rounds; ++r) {
+    struct replaceJob job;
+    memset(&job, 0, sizeof(job));
+    job.buf = buf;
+    job.query = "kilo";
+    job.queryLength = 4;
+    editorReplaceScan(0, 0, buf->numRows, &job);
+    for(int j = 0; j < job.lists[0].length; ++j)
+      matches += job.lists[0].counts[j];
+    free(job.lists[0].rows);
+    free(job.lists[0].counts);
+  }
+  double scanMs = editorElapsedMs(&start) / rounds;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  struct wrapLayout* wrap = editorWrapLayout(buf, 80);
+  double wrapMs = editorElapsedMs(&start);
+
+  printf("%d rows, %.1f MB\n", buf->numRows, megabytes);
+  printf("open   %8.2f ms\n", openMs);
+  printf("join   %8.2f ms %8.0f MB/s\n", joinMs, megabytes * 1000 / joinMs);
+  printf("search %8.2f ms %8.0f MB/s (%ld matches)\n", scanMs,
+      megabytes * 1000 / scanMs, matches / rounds);
+  printf("wrap   %8.2f ms (%d lines at 80 columns)\n", wrapMs,
+      editorWrapLine(wrap, buf->numRows));
+}
+
+/*
+  * Parse sizes such as `512K`, `64M` or `2G`
+*/
+size_t editorParseSize(const char* s) {
+  char* end;
+  size_t size = strtoull(s, &end, 10);
+  switch(toupper((unsigned char)*end)) {
+    case 'G': size *= 1024;
+    /* fall through */
+    case 'M': size *= 1024;
+    /* fall through */
+    case 'K': size *= 1024;
+  }
+  return size;
 }
 
 int main(int argc, char* argv[]) {
 
+  char* filename = NULL;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "--memory-budget") && i + 1 < argc) {
+      E.memoryBudget = editorParseSize(argv[++i]);
+    } else if(!strcmp(argv[i], "--max-fps") && i + 1 < argc) {
+      int fps = atoi(argv[++i]);
+      E.frameInterval = fps > 0 ? 1000 / fps : 0;
+    } else if(!strcmp(argv[i], "--bench-scan") && i + 1 < argc) {
+      editorBenchScan(argv[++i]);
+      return 0;
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  /*
+    * `-` reads standard input, which has to be moved
+    * out of the way of the terminal first
+  */
+  int piped = filename && !strcmp(filename, "-");
+  if(piped && editorOpenStream() == -1) die("kilo -");
+
   enableRawMode();
   initEditor();
-  if(argc >= 2) {
-    editorOpen(argv[1]);
+  if(piped) {
+    stream.buf = E.view->buf;
+  } else if(filename) {
+    if(editorOpen(E.view->buf, filename) == -1) die("fopen");
   }
 
-  editorSetStatusMessage(
-    "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+  editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | "
+      "Ctrl-F = find | Ctrl-R = replace | Ctrl-X = windows");
 
   /*
     Now, the terminal starts in canonical mode, in this
@@ -1227,8 +8783,28 @@ int main(int argc, char* argv[]) {
       + The `ctrl` key combinations that do work seem to
         map the letters A-Z to the codes 1-26.
     */
-    editorRefreshScreen();
-    editorProcessKeypress();
+    editorRender();
+    /*
+      * Sleep until a key, the pipe, the next frame or the
+      * next deadline, whichever comes first. Words left to
+      * count keep it from sleeping, a slice at a time.
+    */
+    while(1) {
+      int counted = editorCountPending();
+      if(counted) editorInvalidate(DIRTY_STATUS);
+      if(editorWaitForInput(counted ? 0 :
+            editorRenderTimeout(KILO_DISK_CHECK_MS)))
+        break;
+      if(editorCheckDisk()) editorInvalidate(DIRTY_ALL);
+      if(editorReadStream()) {
+        editorEnforceMemoryBudget();
+        editorInvalidate(DIRTY_TEXT | DIRTY_STATUS);
+      }
+      editorRender();
+    }
+    editorProcessInput();
+    if(editorCheckDisk()) editorInvalidate(DIRTY_ALL);
+    editorEnforceMemoryBudget();
   }
   return 0;
 }
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#
+# Paste two lines that open and close a comment at the end of a row,
+# and check that the second pasted row is drawn as a comment.
+#
+# usage: tests/paste.py [path to kilo]
+
+import os
+import pty
+import select
+import struct
+import sys
+import tempfile
+import time
+import fcntl
+import termios
+
+KILO = sys.argv[1] if len(sys.argv) > 1 else "./kilo"
+COMMENT = "\x1b[36m"
+
+
+def run(text, keys):
+    handle, path = tempfile.mkstemp(suffix=".c")
+    os.write(handle, text.encode())
+    os.close(handle)
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.execv(KILO, [KILO, path])
+    fcntl.ioctl(fd, termios.TIOCSWINSZ, struct.pack("HHHH", 24, 80, 0, 0))
+    out = b""
+
+    def drain(wait):
+        nonlocal out
+        end = time.time() + wait
+        while time.time() < end:
+            ready, _, _ = select.select([fd], [], [], 0.05)
+            if ready:
+                try:
+                    out += os.read(fd, 65536)
+                except OSError:
+                    return
+
+    drain(0.5)
+    for key in keys:
+        os.write(fd, key.encode())
+        drain(0.1)
+    drain(0.5)
+    os.write(fd, b"\x11\x11\x11\x11")
+    drain(0.3)
+    os.waitpid(pid, 0)
+    os.unlink(path)
+    return out.decode("utf-8", "replace")
+
+
+def last_draw(out, y):
+    # What was last sent for screen line `y`
+    lines = [line for line in out.split("\x1b[K")
+             if "\x1b[%d;1H" % y in line]
+    return lines[-1].split("\x1b[%d;1H" % y)[-1] if lines else ""
+
+
+DOWN, RIGHT, UP, END = "\x1b[B", "\x1b[C", "\x1b[A", "\x1b[F"
+MARK, COPY, YANK = "\x00", "\x0b", "\x19"
+
+out = run("int a;\nfoo /* abc\n def */ x;\n",
+          [DOWN] + [RIGHT] * 4 + [MARK, DOWN] + [RIGHT] * 3 +
+          [COPY, UP, UP, END, YANK])
+line = last_draw(out, 2)
+if not line.startswith(COMMENT + " def */"):
+    print("FAIL: pasted row not drawn as a comment: %r" % line)
+    sys.exit(1)
+print("ok")